@@ -1,21 +1,29 @@
 // Spring 2020
 
-#include "Options.hpp"
 #include "Epsilon.hpp"
 #include "Material.hpp"
 #include "PhongMaterial.hpp"
 #include "Timer.hpp"
+#include "Telemetry.hpp"
+#include "TileScheduler.hpp"
+#include "ThreadPool.hpp"
+#include "CacheCounters.hpp"
+#include "RayPacket.hpp"
+#include "Mesh.hpp"
 #include "A4.hpp"
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include <chrono>
 #include <string>
 #include <vector>
 #include <utility>
-#include <future>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <set>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -24,63 +32,6 @@ using namespace std;
 using namespace glm;
 
 
-#ifdef ENABLE_MULTITHREADING
-static mutex ioMutex;
-static const uint CONCURRENCY = thread::hardware_concurrency();
-#endif
-
-// Convenience function that prints Options.hpp settings
-static void printRenderingOptions()
-{
-
-#ifdef ENABLE_MULTITHREADING
-	cout << "Multithreading enabled" << endl;
-#else
-	cout << "Multithreading disabled. " << endl;
-#endif
-
-#ifdef ENABLE_BOUNDING_VOLUMES
-	string boundingVolumeNames[2] = {
-		"Bounding Box",
-		"Bounding Sphere"
-	};
-
-	cout << "Bounding volume acceleration enabled (" << boundingVolumeNames[BOUNDING_VOLUME] << ")" << endl;
-	#ifdef ENABLE_BOUNDING_VOLUMES
-		cout << "Rendering bounding volumes" << endl;
-	#endif
-#else
-	cout << "Bounding volume acceleration disabled" << endl;
-#endif
-
-#ifdef ENABLE_SUPERSAMPLING
-	cout << "Supersampling enabled" << endl;
-#endif
-
-#ifdef ENABLE_REFLECTIONS
-	cout << "Reflections enabled" << endl;
-#endif
-}
-
-// Safely increments the number of pixels rendered and updates the progress indicator
-#ifdef SHOW_PROGRESS
-static void updateProgress(
-	const pair<size_t, size_t> &pixelDim,
-	uint &pixelsRendered,
-	const uint increment
-)
-{
-#ifdef ENABLE_MULTITHREADING
-	std::lock_guard<std::mutex> lock(ioMutex);
-#endif
-
-	pixelsRendered += increment;
-	cout << "\r" << std::fixed << std::setprecision(2)
-		 << float(pixelsRendered) / (pixelDim.first * pixelDim.second) * 100.0f 
-		 << "% done" << std::flush;
-}
-#endif
-
 // Generate the DCS to WCS matrix (Course Notes 20.1 SI)
 mat4 generateDCStoWorldMat(
 	const pair<size_t, size_t> &pixelDim,
@@ -127,33 +78,80 @@ mat4 generateDCStoWorldMat(
 }
 
 
+// Sky gradient seen by rays that don't hit anything
+static vec3 backgroundColour(const Ray &r)
+{
+	const float t = 0.7f*(glm::normalize(r.direction).y + 1.0f);
+	return vec3(1.0f-t) * DuskColour + t * ZenithColour;
+}
+
+// Instance that last blocked each light's shadow rays on this worker.
+// Neighbouring pixels mostly find the same blocker, so it is tested first
+// and the scene only traversed if it no longer blocks. Reset every tile.
+struct ShadowCache {
+	static const uint32_t NONE = UINT32_MAX;
+
+	std::vector<uint32_t> blockers; // By light index, see LightBVH::forEach
+
+	void reset(size_t numLights)
+	{
+		blockers.assign(numLights, NONE);
+	}
+};
+
+const uint32_t ShadowCache::NONE;
+
+static thread_local ShadowCache shadowCache;
+
+// True if the shadow ray to a light is blocked before the light (t = 1),
+// trying the light's last blocker first if CacheShadows
+template<typename SceneT, bool CacheShadows>
+static bool shadowOccluded(const SceneT *scene, const Ray &shadowRay, uint32_t light)
+{
+	++traversalCounters.shadowRays;
+
+	if(!CacheShadows)
+		return scene->occluded(shadowRay, EPSILON, 1.0);
+
+	uint32_t &blocker = shadowCache.blockers[light];
+	if(blocker != ShadowCache::NONE && scene->occludedBy(blocker, shadowRay, EPSILON, 1.0)){
+		++traversalCounters.shadowCacheHits;
+		return true;
+	}
+
+	blocker = ShadowCache::NONE;
+	return scene->occluded(shadowRay, EPSILON, 1.0, &blocker);
+}
+
+template<typename SceneT, bool Reflections, bool CacheShadows>
 vec3 rayColour(
-	SceneNode *node,
+	const SceneT *scene,
 	const Ray &r,
 	const vec3 &ambient,
-	const list<Light *> &lights,
+	const LightBVH &lights,
+	const RenderSettings &settings,
 	const uint hitsLeft
 )
 {
-	HitRecord rec = node->hit(r, EPSILON, INF_DOUBLE);
+	const RayHit hit = scene->intersect(r, EPSILON, INF_DOUBLE);
 
-	// Hit, compute shadow rays
-	if(rec.hit)
-		return directColour(node, r, rec, ambient, lights, hitsLeft);	
+	// Hit, compute the surface once and shadow rays
+	if(hit)
+		return directColour<SceneT, Reflections, CacheShadows>(scene, r, scene->surface(r, hit), ambient, lights, settings, hitsLeft);	
 
 	// No hit, use background colour
-	else{
-		const float t = 0.7f*(glm::normalize(r.direction).y + 1.0f);
-		return vec3(1.0f-t) * DuskColour + t * ZenithColour;
-	}
+	else
+		return backgroundColour(r);
 }
 
+template<typename SceneT, bool Reflections, bool CacheShadows>
 vec3 directColour(
-	SceneNode *node,
+	const SceneT *scene,
 	const Ray &primRay,
 	const HitRecord &primRec,
 	const vec3 &ambient,
-	const list<Light *> &lights,
+	const LightBVH &lights,
+	const RenderSettings &settings,
 	const uint hitsLeft
 )
 {
@@ -173,13 +171,13 @@ vec3 directColour(
 	const vec4 p = primRec.point + CORRECTION * n;     // Intersection point (corrected)
 	const vec4 v = glm::normalize(primRay.origin - p); // Intersection to eye point vector
 
-	// Compute shadow rays
-	for(const auto light : lights){
+	// Compute shadow rays, only for lights bright enough to matter here
+	lights.forEach(vec3(p), [&](const Light *light, uint32_t lightIndex) {
+		// The light is at t = 1 along the shadow ray
 		const Ray shadowRay(p, vec4(light->position, 1) - p);
 
-		// Shade pixel if shadow ray isn't obstructed
-		HitRecord rec = node->hit(shadowRay, EPSILON, INF_DOUBLE);
-		if(!rec.hit){
+		// Shade pixel if shadow ray isn't obstructed before reaching the light
+		if(!shadowOccluded<SceneT, CacheShadows>(scene, shadowRay, lightIndex)){
 			// Blinn-Phong Shading
 			const vec3 &I = light->colour;
 			const double *falloff = light->falloff;
@@ -196,80 +194,888 @@ vec3 directColour(
 			// Specular component
 			col += ks * I * std::pow(std::max(0.0f, glm::dot(n, h)), ke) * attenuation;
 		}
-	}
+	});
 
 	// Reflect light off of anything except the ground plane
 	// Note: Check for ground plane is hacky
-#ifdef ENABLE_REFLECTIONS
-	if(hitsLeft > 0 && *primRec.name != "plane"){
+	if(Reflections && hitsLeft > 0 && *primRec.name != "plane"){
 		const auto r = glm::reflect(d, n); // Reflection direction
 		const Ray reflectedRay(p, r);
-		const vec3 reflectionCol = rayColour(node, reflectedRay, ambient, lights, hitsLeft-1);
-		col = glm::mix(col, reflectionCol, REFLECTION_MIX_FACTOR);
+		++traversalCounters.reflectionRays;
+		const vec3 reflectionCol = rayColour<SceneT, Reflections, CacheShadows>(scene, reflectedRay, ambient, lights, settings, hitsLeft-1);
+		col = glm::mix(col, reflectionCol, float(settings.reflectionMix));
 	}
-#endif
 
 	return col;
 }
 
-static void renderChunk(
-	const pair<size_t, size_t> &pixelDim,
-	const uint xStart, const uint xEnd,
+// Colours of up to SIMD_WIDTH coherent rays, traced through the scene as one
+// packet. Shadow and reflection rays are incoherent, so they are traced one
+// at a time by directColour.
+template<typename SceneT, bool Reflections, bool CacheShadows>
+static void packetColour(
+	const SceneT *scene,
+	const Ray *rays,
+	const uint count,
+	const vec3 &ambient,
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	const uint hitsLeft,
+	vec3 *colours
+)
+{
+	RayPacket packet(rays, count, EPSILON, INF_DOUBLE);
+	RayHit hits[SIMD_WIDTH];
+
+	scene->intersectPacket(packet, hits);
+
+	for(uint lane = 0; lane < count; ++lane){
+		if(hits[lane])
+			colours[lane] = directColour<SceneT, Reflections, CacheShadows>(scene, rays[lane], scene->surface(rays[lane], hits[lane]), ambient, lights, settings, hitsLeft);
+		else
+			colours[lane] = backgroundColour(rays[lane]);
+	}
+}
+
+// ------------------------------------------------------------
+// Heatmap cost so far on this thread (see HeatmapMetric), sampled around
+// each traversal. Kernels are instantiated with one of these, so NoCost
+// compiles the measuring out.
+struct NoCost {
+	static const bool enabled = false;
+	double operator()() const { return 0.0; }
+};
+
+struct TimeCost {
+	static const bool enabled = true;
+	double operator()() const
+	{
+		return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+struct StepsCost {
+	static const bool enabled = true;
+	double operator()() const
+	{
+		return double(traversalCounters.boxTests + traversalCounters.triangleTests);
+	}
+};
+
+// ------------------------------------------------------------
+// Wavefront tracing. Instead of following each sample's shadow and
+// reflection rays depth first, a batch of samples is traced one bounce at a
+// time: every ray of the bounce is intersected, the shadow rays of all hits
+// go into one queue and the reflected rays into the next bounce's. Both are
+// sorted by direction octant and then origin along a Morton curve before
+// they are traced, so consecutive rays take similar paths through the
+// hierarchies (and reflected rays make coherent packets).
+
+// Rays are bucketed by a 12 bit key: the direction octant, then the Morton
+// code of the origin on an 8x8x8 grid over the queue's origins. A stable
+// counting sort keeps rays of the same bucket in the order they were queued.
+static const uint RAY_KEY_BITS = 12;
+
+// Spread the low 3 bits of x out so two zero bits separate each
+static uint32_t spreadBits(uint32_t x)
+{
+	return (x & 1) | ((x & 2) << 2) | ((x & 4) << 4);
+}
+
+static uint32_t rayKey(const Ray &r, const AABB &bounds)
+{
+	const uint32_t octant = (r.direction.x < 0 ? 1 : 0) | (r.direction.y < 0 ? 2 : 0) | (r.direction.z < 0 ? 4 : 0);
+
+	const vec3 extent = glm::max(bounds.max - bounds.min, vec3(1e-6f));
+	const vec3 cell = glm::clamp((vec3(r.origin) - bounds.min) / extent * 8.0f, 0.0f, 7.0f);
+
+	return (octant << 9) | (spreadBits(uint32_t(cell.x)) << 2) | (spreadBits(uint32_t(cell.y)) << 1) | spreadBits(uint32_t(cell.z));
+}
+
+// Queues of a worker's wavefront, kept between batches to reuse their memory
+struct WavefrontQueues {
+	// Rays of the current bounce, the sample each one adds to and its weight
+	vector<Ray> rays;
+	vector<uint32_t> samples;
+	vector<float> weights;
+
+	// What they hit, and for each hit its surface, the light reaching it and
+	// whether it reflects
+	vector<RayHit> hits;
+	vector<PhongMaterial *> materials;
+	vector<vec4> normals;
+	vector<vec4> views; // Towards the ray's origin
+	vector<vec3> direct;
+	vector<char> reflects;
+
+	// Reflected rays, the next bounce
+	vector<Ray> nextRays;
+	vector<uint32_t> nextSamples;
+	vector<float> nextWeights;
+
+	// Shadow rays of the bounce
+	struct ShadowRay {
+		Ray ray;
+		uint32_t hit;        // Index into hits
+		uint32_t lightIndex; // See LightBVH::forEach
+		const Light *light;
+	};
+	vector<ShadowRay> shadowRays;
+	vector<char> blocked;
+
+	// Sorting scratch, see sortRays
+	vector<uint32_t> keys;
+	vector<uint32_t> buckets;
+	vector<uint32_t> order;
+	vector<Ray> sortedRays;
+	vector<uint32_t> sortedSamples;
+	vector<float> sortedWeights;
+};
+
+static thread_local WavefrontQueues wavefrontQueues;
+
+// Indices of count rays in rayKey order into q.order, ray(i) is the i-th ray
+template<typename GetRay>
+static void sortRays(size_t count, GetRay ray, WavefrontQueues &q)
+{
+	AABB bounds;
+	for(size_t i = 0; i < count; ++i)
+		bounds.expand(vec3(ray(i).origin));
+
+	q.keys.resize(count);
+	q.buckets.assign((1u << RAY_KEY_BITS) + 1, 0);
+	for(size_t i = 0; i < count; ++i){
+		q.keys[i] = rayKey(ray(i), bounds);
+		++q.buckets[q.keys[i] + 1];
+	}
+
+	// Start of each bucket
+	for(size_t b = 1; b < q.buckets.size(); ++b)
+		q.buckets[b] += q.buckets[b - 1];
+
+	q.order.resize(count);
+	for(size_t i = 0; i < count; ++i)
+		q.order[q.buckets[q.keys[i]]++] = uint32_t(i);
+}
+
+// Colours of count primary rays, traced as a wavefront. Shading matches
+// directColour and light is added to each hit in the same order, so images
+// without reflections are unchanged (reflected rays are traced in packets
+// here, which can move a reflection by a rounding error). Unless Cost is
+// NoCost, measureCost() is sampled around every traversal and the
+// difference added to costs (one per ray, zeroed first).
+template<typename SceneT, bool Reflections, bool CacheShadows, typename Cost>
+static void wavefrontColours(
+	const SceneT *scene,
+	const Ray *primaryRays,
+	const size_t count,
+	const vec3 &ambient,
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	const uint maxHits,
+	vec3 *colours,
+	float *costs,
+	Cost measureCost
+)
+{
+	WavefrontQueues &q = wavefrontQueues;
+
+	q.rays.assign(primaryRays, primaryRays + count);
+	q.samples.resize(count);
+	q.weights.assign(count, 1.0f);
+	for(size_t i = 0; i < count; ++i)
+		q.samples[i] = uint32_t(i);
+
+	std::fill(colours, colours + count, vec3(0.0f));
+	if(Cost::enabled)
+		std::fill(costs, costs + count, 0.0f);
+
+	const float mix = float(settings.reflectionMix);
+
+	for(uint bounce = 0; !q.rays.empty(); ++bounce){
+		const size_t n = q.rays.size();
+
+		// Camera rays are coherent already, reflected rays are sorted
+		if(bounce > 0){
+			sortRays(n, [&](size_t i) -> const Ray & { return q.rays[i]; }, q);
+
+			q.sortedRays.resize(n);
+			q.sortedSamples.resize(n);
+			q.sortedWeights.resize(n);
+			for(size_t i = 0; i < n; ++i){
+				const uint32_t from = q.order[i];
+				q.sortedRays[i] = q.rays[from];
+				q.sortedSamples[i] = q.samples[from];
+				q.sortedWeights[i] = q.weights[from];
+			}
+
+			q.rays.swap(q.sortedRays);
+			q.samples.swap(q.sortedSamples);
+			q.weights.swap(q.sortedWeights);
+		}
+
+		// Intersect the whole bounce, SIMD_WIDTH rays at a time
+		q.hits.assign(n, RayHit());
+
+		for(size_t first = 0; first < n; first += SIMD_WIDTH){
+			const uint lanes = uint(std::min<size_t>(SIMD_WIDTH, n - first));
+			const double costBefore = measureCost();
+
+			if(settings.packets){
+				RayPacket packet(&q.rays[first], lanes, EPSILON, INF_DOUBLE);
+				scene->intersectPacket(packet, &q.hits[first]);
+			} else {
+				for(uint lane = 0; lane < lanes; ++lane)
+					q.hits[first + lane] = scene->intersect(q.rays[first + lane], EPSILON, INF_DOUBLE);
+			}
+
+			if(Cost::enabled){
+				const float cost = float((measureCost() - costBefore) / lanes);
+				for(uint lane = 0; lane < lanes; ++lane)
+					costs[q.samples[first + lane]] += cost;
+			}
+		}
+
+		// Shade every hit, queueing its shadow and reflected rays
+		q.materials.resize(n);
+		q.normals.resize(n);
+		q.views.resize(n);
+		q.direct.resize(n);
+		q.reflects.assign(n, 0);
+		q.shadowRays.clear();
+		q.nextRays.clear();
+		q.nextSamples.clear();
+		q.nextWeights.clear();
+
+		for(size_t i = 0; i < n; ++i){
+			if(!q.hits[i])
+				continue;
+
+			const Ray &primRay = q.rays[i];
+			const HitRecord primRec = scene->surface(primRay, q.hits[i]);
+
+			const auto mat = static_cast<PhongMaterial *>(primRec.mat);
+			q.direct[i] = mat->diffuse() * ambient;
+
+			const vec4 &d = primRay.direction;
+			const vec4 nrm = glm::normalize(primRec.n);
+			const vec4 p = primRec.point + CORRECTION * nrm;
+
+			q.materials[i] = mat;
+			q.normals[i] = nrm;
+			q.views[i] = glm::normalize(primRay.origin - p);
+
+			// Shaded once the queue is traced, and only if unblocked
+			lights.forEach(vec3(p), [&](const Light *light, uint32_t lightIndex) {
+				q.shadowRays.push_back({ Ray(p, vec4(light->position, 1) - p), uint32_t(i), lightIndex, light });
+			});
+
+			// Same hacky ground plane check as directColour
+			if(Reflections && bounce < maxHits && *primRec.name != "plane"){
+				q.reflects[i] = 1;
+				q.nextRays.emplace_back(p, glm::reflect(d, nrm));
+				q.nextSamples.push_back(q.samples[i]);
+				q.nextWeights.push_back(q.weights[i] * mix);
+				++traversalCounters.reflectionRays;
+			}
+		}
+
+		// Trace the shadow queue in sorted order
+		const size_t numShadowRays = q.shadowRays.size();
+		sortRays(numShadowRays, [&](size_t i) -> const Ray & { return q.shadowRays[i].ray; }, q);
+		q.blocked.resize(numShadowRays);
+
+		for(const uint32_t s : q.order){
+			const WavefrontQueues::ShadowRay &shadow = q.shadowRays[s];
+			const double costBefore = measureCost();
+
+			q.blocked[s] = shadowOccluded<SceneT, CacheShadows>(scene, shadow.ray, shadow.lightIndex);
+
+			if(Cost::enabled)
+				costs[q.samples[shadow.hit]] += float(measureCost() - costBefore);
+		}
+
+		// Blinn-Phong shading of unblocked lights, added in the order they
+		// were queued
+		for(size_t s = 0; s < numShadowRays; ++s){
+			if(q.blocked[s])
+				continue;
+
+			const WavefrontQueues::ShadowRay &shadow = q.shadowRays[s];
+			const uint32_t i = shadow.hit;
+
+			PhongMaterial *mat = q.materials[i];
+			const auto &kd = mat->diffuse();
+			const auto &ks = mat->specular();
+			const auto &ke = mat->shininess();
+
+			const vec4 &nrm = q.normals[i];
+			const vec3 &I = shadow.light->colour;
+			const double *falloff = shadow.light->falloff;
+
+			vec4 l = glm::normalize(shadow.ray.direction);
+			vec4 h = glm::normalize(q.views[i] + l);
+
+			double shadowRayLen = glm::length(shadow.ray.direction);
+			double attenuation = 1.0 / (falloff[0] + falloff[1] * shadowRayLen + falloff[2] * shadowRayLen * shadowRayLen);
+
+			q.direct[i] += kd * I * std::max(0.0f, glm::dot(nrm, l)) * attenuation;
+			q.direct[i] += ks * I * std::pow(std::max(0.0f, glm::dot(nrm, h)), ke) * attenuation;
+		}
+
+		// Each sample's colour is the weighted sum over its bounces, which
+		// unrolls directColour's mix with the reflected colour
+		for(size_t i = 0; i < n; ++i){
+			vec3 &colour = colours[q.samples[i]];
+			const float weight = q.weights[i];
+
+			if(!q.hits[i])
+				colour += weight * backgroundColour(q.rays[i]);
+			else if(q.reflects[i])
+				colour += weight * (1.0f - mix) * q.direct[i];
+			else
+				colour += weight * q.direct[i];
+		}
+
+		q.rays.swap(q.nextRays);
+		q.samples.swap(q.nextSamples);
+		q.weights.swap(q.nextWeights);
+	}
+}
+
+// How each pixel is sampled
+enum class Sampling {
+	Single,   // One sample per pixel
+	Grid,     // ssFactor x ssFactor samples per pixel
+	Adaptive  // Pixel corners first, the grid only where the corners disagree
+};
+
+// Sampling decisions during a render, shared by every worker. Ray and
+// traversal counts go through Telemetry.
+struct SampleStats {
+	std::atomic<uint64_t> refinedPixels;
+};
+
+// Largest component of a colour
+static float maxComponent(const vec3 &c)
+{
+	return std::max(c.r, std::max(c.g, c.b));
+}
+
+// Trace the primary rays through the given DCS positions, SIMD_WIDTH at a
+// time as packets unless they are disabled, or all at once with wavefront.
+// Neighbouring positions should be next to each other so the packets stay
+// coherent.
+//
+// Unless Cost is NoCost, the cost of each packet is split evenly between
+// its samples in sampleCosts.
+template<typename SceneT, bool Reflections, bool CacheShadows, typename Cost>
+static void traceBatch(
+	const SceneT *scene,
+	const vector<vec2> &positions,
+	const mat4 &dcsToWorld,
+	const vec4 &eye,
+	const vec3 &ambient,
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	const uint maxHits,
+	vector<Ray> &rays,
+	vector<vec3> &colours,
+	vector<float> &sampleCosts
+)
+{
+	const size_t count = positions.size();
+	const Cost measureCost;
+
+	colours.resize(count);
+	traversalCounters.primaryRays += count;
+
+	if(Cost::enabled)
+		sampleCosts.resize(count);
+
+	rays.resize(count);
+	for(size_t i = 0; i < count; ++i){
+		const vec4 p_world = dcsToWorld * vec4(positions[i].x, positions[i].y, 0, 1); // Pixel position (WCS)
+		rays[i] = Ray(eye, p_world - eye);
+	}
+
+	// Every sample of the batch at once
+	if(settings.wavefront){
+		wavefrontColours<SceneT, Reflections, CacheShadows>(scene, rays.data(), count, ambient, lights, settings, maxHits,
+			colours.data(), sampleCosts.data(), measureCost);
+		return;
+	}
+
+	auto forEachPacket = [&](auto traceRays) {
+		for(size_t first = 0; first < count; first += SIMD_WIDTH){
+			const uint lanes = uint(std::min<size_t>(SIMD_WIDTH, count - first));
+			const double costBefore = measureCost();
+
+			traceRays(first, lanes);
+
+			if(Cost::enabled){
+				const float cost = float((measureCost() - costBefore) / lanes);
+				std::fill(sampleCosts.begin() + first, sampleCosts.begin() + first + lanes, cost);
+			}
+		}
+	};
+
+	if(settings.packets){
+		forEachPacket([&](size_t first, uint lanes) {
+			packetColour<SceneT, Reflections, CacheShadows>(scene, &rays[first], lanes, ambient, lights, settings, maxHits, &colours[first]);
+		});
+	} else {
+		forEachPacket([&](size_t first, uint lanes) {
+			for(uint lane = 0; lane < lanes; ++lane)
+				colours[first + lane] = rayColour<SceneT, Reflections, CacheShadows>(scene, rays[first + lane], ambient, lights, settings, maxHits);
+		});
+	}
+}
+
+// Render a tile of the image. Instantiated once per combination of scene
+// type, sampling mode, reflections and shadow cache so the per-pixel loop
+// doesn't branch on the settings.
+template<typename SceneT, Sampling Mode, bool Reflections, bool CacheShadows>
+static void renderTile(
+	const Tile &tile,
 
 	Image &image,
+	Image *costs, // Per pixel cost for the heatmap, if one was asked for
 
-	SceneNode *root,
+	const SceneT *scene,
 
 	const mat4 &dcsToWorld,
 	const vec4 &eye,
 
 	const vec3 & ambient,
-	const list<Light *> & lights,
+	const LightBVH & lights,
 
-	uint &pixelsRendered
+	const RenderSettings &settings,
+	SampleStats &sampleStats
 )
 {
-	const uint n_y = pixelDim.second;
+	// Supersample on an ssFactor x ssFactor grid, a single sample otherwise
+	const uint ssFactor = Mode == Sampling::Single ? 1 : settings.ssFactor;
+	const double SS_INV = 1.0 / ssFactor;
+	const uint maxHits = Reflections ? settings.maxHits : 0;
+
+	uint64_t refinedPixels = 0;
+
+	if(CacheShadows)
+		shadowCache.reset(lights.numLights());
 
-	for(uint x = xStart; x < xEnd; ++x) {
-		for(uint y = 0; y < n_y; ++y){
-			vec3 col(0.0f);                // Pixel colour
-			vec4 p_dcs = vec4(x, y, 0, 1); // Pixel position (DCS)
+	// Pick the heatmap measure once per tile rather than per sample
+	typedef void (*TraceFn)(const SceneT *, const vector<vec2> &, const mat4 &, const vec4 &, const vec3 &,
+		const LightBVH &, const RenderSettings &, uint, vector<Ray> &, vector<vec3> &, vector<float> &);
 
-		// Supersample
-#ifdef ENABLE_SUPERSAMPLING
-			double SS_INV = 1.0 / SS_FACTOR;
+	const HeatmapMetric metric = costs ? settings.heatmap : HeatmapOff;
+	const TraceFn trace =
+		metric == HeatmapTime ? traceBatch<SceneT, Reflections, CacheShadows, TimeCost> :
+		metric == HeatmapSteps ? traceBatch<SceneT, Reflections, CacheShadows, StepsCost> :
+		traceBatch<SceneT, Reflections, CacheShadows, NoCost>;
 
-			for(uint u = 0; u < SS_FACTOR; ++u){
-				for(uint v = 0; v < SS_FACTOR; ++v){
-					p_dcs.x = x + double(u) * SS_INV;
-					p_dcs.y = y + double(v) * SS_INV;
-#endif
-					const vec4 p_world = dcsToWorld * p_dcs; // Pixel position (WCS)
-					const Ray ray(eye, p_world - eye);
+	vector<Ray> rays;
+	vector<float> sampleCosts;
 
-					// Compute pixel colour
-					col += rayColour(root, ray, ambient, lights, MAX_HITS);
+	auto traceSamples = [&](const vector<vec2> &positions, vector<vec3> &colours) {
+		trace(scene, positions, dcsToWorld, eye, ambient, lights, settings, maxHits, rays, colours, sampleCosts);
+	};
+
+	// Pixels are collected in row major order and copied into the image
+	// once the tile is done
+	const uint tileWidth = tile.x1 - tile.x0;
+	vector<vec3> pixels(tile.pixels());
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "pixels are copied as packed RGB floats");
+
+	auto writePixel = [&](uint x, uint y, const vec3 &col) {
+		pixels[(y - tile.y0) * tileWidth + (x - tile.x0)] = col;
+	};
 
-#ifdef ENABLE_SUPERSAMPLING
+	// Heatmap costs, in the first component
+	vector<vec3> pixelCosts(metric != HeatmapOff ? tile.pixels() : 0, vec3(0.0f));
+
+	auto addCost = [&](uint x, uint y, float cost) {
+		pixelCosts[(y - tile.y0) * tileWidth + (x - tile.x0)].x += cost;
+	};
+
+	vector<vec2> positions;
+	vector<vec3> colours;
+
+	if(Mode != Sampling::Adaptive){
+		// Every sample of the tile, pixel by pixel in row major order
+		positions.reserve(tile.pixels() * ssFactor * ssFactor);
+
+		for(uint y = tile.y0; y < tile.y1; ++y){
+			for(uint x = tile.x0; x < tile.x1; ++x){
+				for(uint u = 0; u < ssFactor; ++u){
+					for(uint v = 0; v < ssFactor; ++v)
+						positions.emplace_back(x + double(u) * SS_INV, y + double(v) * SS_INV);
 				}
 			}
+		}
+
+		traceSamples(positions, colours);
 
-			// Average sampled pixel colours
-			col *= SS_INV * SS_INV;
-#endif
+		const uint samplesPerPixel = ssFactor * ssFactor;
 
-			// Red: 
-			image(x, y, Cone::R) = col[Cone::R];
-			// Green: 
-			image(x, y, Cone::G) = col[Cone::G];
-			// Blue: 
-			image(x, y, Cone::B) = col[Cone::B];
+		for(uint y = tile.y0; y < tile.y1; ++y){
+			for(uint x = tile.x0; x < tile.x1; ++x){
+				const size_t first = size_t((y - tile.y0) * tileWidth + (x - tile.x0)) * samplesPerPixel;
+
+				vec3 col(0.0f); // Pixel colour
+				for(uint s = 0; s < samplesPerPixel; ++s)
+					col += colours[first + s];
+
+				// Average sampled pixel colours
+				if(Mode == Sampling::Grid)
+					col *= SS_INV * SS_INV;
+
+				writePixel(x, y, col);
+			}
+		}
+
+		if(metric != HeatmapOff){
+			for(uint y = tile.y0; y < tile.y1; ++y){
+				for(uint x = tile.x0; x < tile.x1; ++x){
+					const size_t first = size_t((y - tile.y0) * tileWidth + (x - tile.x0)) * samplesPerPixel;
+					for(uint s = 0; s < samplesPerPixel; ++s)
+						addCost(x, y, sampleCosts[first + s]);
+				}
+			}
 		}
+	} else {
+		// First pass: one sample on every pixel corner of the tile, shared
+		// between neighbouring pixels
+		const uint cornersPerRow = tileWidth + 1;
+		positions.reserve(cornersPerRow * (tile.y1 - tile.y0 + 1));
+
+		for(uint y = tile.y0; y <= tile.y1; ++y){
+			for(uint x = tile.x0; x <= tile.x1; ++x)
+				positions.emplace_back(x, y);
+		}
+
+		vector<vec3> corners;
+		traceSamples(positions, corners);
+		const vector<float> cornerCosts = sampleCosts;
+
+		const float threshold = float(settings.adaptiveThreshold);
+
+		for(uint y = tile.y0; y < tile.y1; ++y){
+			for(uint x = tile.x0; x < tile.x1; ++x){
+				const uint corner = (y - tile.y0) * cornersPerRow + (x - tile.x0);
+				const vec3 &c00 = corners[corner];
+				const vec3 &c10 = corners[corner + 1];
+				const vec3 &c01 = corners[corner + cornersPerRow];
+				const vec3 &c11 = corners[corner + cornersPerRow + 1];
+
+				// Corners are shared by up to four pixels
+				if(metric != HeatmapOff){
+					addCost(x, y, 0.25f * (cornerCosts[corner] + cornerCosts[corner + 1] +
+						cornerCosts[corner + cornersPerRow] + cornerCosts[corner + cornersPerRow + 1]));
+				}
+
+				// Contrast between the pixel's corners
+				const vec3 lo = glm::min(glm::min(c00, c10), glm::min(c01, c11));
+				const vec3 hi = glm::max(glm::max(c00, c10), glm::max(c01, c11));
 
-#ifdef SHOW_PROGRESS
-		updateProgress(pixelDim, pixelsRendered, n_y);
-#endif
+				if(maxComponent(hi - lo) <= threshold){
+					writePixel(x, y, 0.25f * (c00 + c10 + c01 + c11));
+					continue;
+				}
+
+				// Refine on the grid one row at a time (one small packet per
+				// row), stopping once the variance of the estimate is below
+				// the threshold. The first grid sample is the pixel's top-left
+				// corner.
+				vec3 sum(c00), sumSq(c00 * c00);
+				uint n = 1;
+
+				for(uint v = 0; v < ssFactor; ++v){
+					positions.clear();
+					for(uint u = (v == 0 ? 1 : 0); u < ssFactor; ++u)
+						positions.emplace_back(x + double(u) * SS_INV, y + double(v) * SS_INV);
+
+					traceSamples(positions, colours);
+
+					for(const auto &s : colours){
+						sum += s;
+						sumSq += s * s;
+					}
+					n += colours.size();
+
+					if(metric != HeatmapOff){
+						for(const float cost : sampleCosts)
+							addCost(x, y, cost);
+					}
+
+					if(v > 0){
+						const vec3 mean = sum / float(n);
+						const vec3 variance = sumSq / float(n) - mean * mean;
+						if(maxComponent(variance) / n < 0.25f * threshold * threshold)
+							break;
+					}
+				}
+
+				writePixel(x, y, sum / float(n));
+				++refinedPixels;
+			}
+		}
+	}
+
+	image.setPixels(tile.x0, tile.y0, tileWidth, tile.y1 - tile.y0, glm::value_ptr(pixels[0]));
+	if(metric != HeatmapOff)
+		costs->setPixels(tile.x0, tile.y0, tileWidth, tile.y1 - tile.y0, glm::value_ptr(pixelCosts[0]));
+
+	sampleStats.refinedPixels += refinedPixels;
+}
+
+template<typename SceneT>
+using TileKernel = void (*)(
+	const Tile &,
+	Image &,
+	Image *,
+	const SceneT *,
+	const mat4 &,
+	const vec4 &,
+	const vec3 &,
+	const LightBVH &,
+	const RenderSettings &,
+	SampleStats &
+);
+
+template<typename SceneT, Sampling Mode, bool Reflections>
+static TileKernel<SceneT> selectKernel(const RenderSettings &settings)
+{
+	return settings.shadowCache ? renderTile<SceneT, Mode, Reflections, true> : renderTile<SceneT, Mode, Reflections, false>;
+}
+
+template<typename SceneT, Sampling Mode>
+static TileKernel<SceneT> selectKernel(const RenderSettings &settings)
+{
+	return settings.reflections ? selectKernel<SceneT, Mode, true>(settings) : selectKernel<SceneT, Mode, false>(settings);
+}
+
+// Pick the renderTile instantiation matching the settings, once per render
+template<typename SceneT>
+static TileKernel<SceneT> selectKernel(const RenderSettings &settings)
+{
+	if(!settings.supersampling)
+		return selectKernel<SceneT, Sampling::Single>(settings);
+
+	if(settings.adaptive)
+		return selectKernel<SceneT, Sampling::Adaptive>(settings);
+
+	return selectKernel<SceneT, Sampling::Grid>(settings);
+}
+
+template<typename SceneT>
+static void renderScene(
+	const SceneT *scene,
+	Image &image,
+	Image *costs,
+	const mat4 &dcsToWorld,
+	const vec4 &eye,
+	const vec3 &ambient,
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	chrono::steady_clock::time_point sceneStart
+)
+{
+	// Image dimensions
+	const size_t n_x = image.width();
+	const size_t n_y = image.height();
+
+	const TileKernel<SceneT> kernel = selectKernel<SceneT>(settings);
+
+	Timer timer;
+
+	// Split the image into tiles, workers steal tiles from each other
+	// once they run out
+	TileScheduler scheduler(n_x, n_y, settings.tileSize, settings.tileOrder);
+	const uint numWorkers = settings.numWorkers();
+
+	static const string tileOrderNames[3] = {
+		"rows",
+		"Morton order",
+		"Hilbert order"
+	};
+
+	// Workers past the first come from the shared pool, which keeps its
+	// threads between renders
+	ThreadPool &pool = ThreadPool::shared();
+	pool.reserve(numWorkers - 1);
+	const bool pinned = pool.pin(settings.pinThreads);
+
+	cout << endl << "Tile settings: " << endl;
+		cout << "\t" << numWorkers << " workers" << endl;
+		cout << "\t" << scheduler.numTiles() << " tiles (" << settings.tileSize << "x" << settings.tileSize
+			 << ", " << tileOrderNames[settings.tileOrder] << ")" << endl;
+		cout << "\tThread pool: " << pool.numThreads() << " threads"
+			 << (settings.pinThreads ? (pinned ? ", pinned" : ", pinning failed") : "")
+			 << " (" << pool.threadsStarted() << " started since launch)" << endl;
+
+	SampleStats sampleStats;
+	sampleStats.refinedPixels = 0;
+
+	// Per worker counters, and a reporter thread printing progress
+	Telemetry telemetry(numWorkers, n_x, n_y);
+
+	// Lazy meshes load during tracing, see Mesh.hpp
+	const Mesh::LazyLoadStats lazyBefore = Mesh::lazyLoadStats();
+
+	const auto start = chrono::steady_clock::now();
+
+	// Set by any worker whose cache counters can't be read
+	atomic<bool> cacheCountersFailed(false);
+
+	// Set by whichever worker finishes a tile first
+	atomic<bool> firstTileDone(false);
+	chrono::steady_clock::time_point firstTile = start;
+
+	telemetry.start(settings.showProgress);
+
+	scheduler.run(numWorkers, [&](uint worker, const Tile &tile) {
+		const TraversalCounters before = traversalCounters;
+		const auto tileStart = chrono::steady_clock::now();
+
+		CacheCounts cacheBefore;
+		const bool countCache = settings.cacheCounters && CacheCounters::read(cacheBefore);
+		if(settings.cacheCounters && !countCache)
+			cacheCountersFailed = true;
+
+		kernel(tile, image, costs, scene, dcsToWorld, eye, ambient, lights, settings, sampleStats);
+
+		CacheCounts cacheAfter;
+		if(countCache && CacheCounters::read(cacheAfter)){
+			traversalCounters.cacheReferences += cacheAfter.references - cacheBefore.references;
+			traversalCounters.cacheMisses += cacheAfter.misses - cacheBefore.misses;
+		}
+
+		const auto tileEnd = chrono::steady_clock::now();
+		telemetry.tileDone(worker, tile.pixels(), traversalCounters - before,
+			chrono::duration<double, milli>(tileEnd - tileStart).count());
+
+		if(!firstTileDone.exchange(true))
+			firstTile = tileEnd;
+	});
+
+	telemetry.stop();
+	const double seconds = telemetry.traceMs() * 1e-3;
+
+	cout << endl;
+	scheduler.printStats(cout);
+
+	// Samples actually spent, compared to the full supersampling grid
+	const TraversalCounters counters = telemetry.counters();
+	const uint64_t numPixels = uint64_t(n_x) * n_y;
+	const uint64_t samples = counters.primaryRays;
+
+	// Preprocessing is everything from loading the scene to tracing, plus
+	// meshes loaded lazily on the way
+	const Mesh::LazyLoadStats lazyAfter = Mesh::lazyLoadStats();
+	const uint64_t lazyMeshes = lazyAfter.meshes - lazyBefore.meshes;
+	const double lazyMs = lazyAfter.ms - lazyBefore.ms;
+	const double preprocessingMs = chrono::duration<double, milli>(start - sceneStart).count();
+	const double firstTileMs = chrono::duration<double, milli>(firstTile - sceneStart).count();
+
+	cout << "Tracing: " << seconds * 1000.0 << "ms" << endl;
+	cout << "Time to first tile: " << firstTileMs << "ms since the scene started loading" << endl;
+	cout << "Preprocessing: " << preprocessingMs + lazyMs << "ms (" << preprocessingMs << "ms before tracing";
+	if(settings.lazyMeshes)
+		cout << ", " << lazyMs << "ms loading " << lazyMeshes << " meshes lazily";
+	cout << ")" << endl;
+	cout << Mesh::takeLazyLoadLog();
+	cout << "Samples: " << samples << " (" << double(samples) / numPixels << " per pixel, "
+		 << samples / seconds * 1e-6 << "M primary rays/s)" << endl;
+
+	if(settings.supersampling && settings.adaptive){
+		const uint64_t gridSamples = numPixels * settings.ssFactor * settings.ssFactor;
+
+		cout << "\tadaptive: refined " << sampleStats.refinedPixels << " of " << numPixels << " pixels, "
+			 << 100.0 * samples / gridSamples << "% of the " << settings.ssFactor << "x" << settings.ssFactor << " grid" << endl;
+	}
+
+	cout << "Rays: " << counters.primaryRays << " primary, " << counters.shadowRays << " shadow, "
+		 << counters.reflectionRays << " reflection (" << telemetry.mraysPerSecond() << " Mrays/s)" << endl;
+
+	// Every ray through the scene, primary, shadow and reflected
+	const uint64_t rays = counters.rays;
+	const uint64_t nodes = counters.nodes;
+
+	cout << "Traversal: " << rays << " rays, " << nodes << " nodes visited ("
+		 << (rays > 0 ? double(nodes) / rays : 0.0) << " per ray), "
+		 << counters.boxTests << " box tests, " << counters.triangleTests << " triangle tests" << endl;
+
+	if(settings.shadowCache){
+		const uint64_t shadowRays = counters.shadowRays;
+		const uint64_t cacheHits = counters.shadowCacheHits;
+
+		cout << "Shadow cache: " << cacheHits << " of " << shadowRays << " shadow rays blocked by the last blocker ("
+			 << (shadowRays > 0 ? 100.0 * cacheHits / shadowRays : 0.0) << "% hit rate)" << endl;
+	}
+
+	if(settings.cacheCounters){
+		if(cacheCountersFailed){
+			cout << "Cache counters: unavailable (no hardware performance counters, or perf_event_paranoid)" << endl;
+		} else {
+			cout << "Cache counters: " << counters.cacheMisses << " last level misses of " << counters.cacheReferences
+				 << " references (" << (counters.cacheReferences > 0 ? 100.0 * counters.cacheMisses / counters.cacheReferences : 0.0)
+				 << "%), " << (numPixels > 0 ? double(counters.cacheMisses) / numPixels : 0.0) << " per pixel" << endl;
+		}
+	}
+
+	// Machine readable summary, to a file or "-" for cout
+	if(!settings.statsJson.empty()){
+		if(settings.statsJson == "-"){
+			telemetry.writeJson(cout, scheduler.stats(), preprocessingMs + lazyMs, firstTileMs);
+		} else {
+			ofstream json(settings.statsJson);
+			if(json)
+				telemetry.writeJson(json, scheduler.stats(), preprocessingMs + lazyMs, firstTileMs);
+			else
+				cerr << "Couldn't write " << settings.statsJson << endl;
+		}
+	}
+}
+
+// Memory taken by the nodes of a binary hierarchy and of its wide version
+static void printHierarchyMemory(const string &name, const BVH &bvh, const WideBVH &wideBVH)
+{
+	const size_t binaryBytes = bvh.nodes().size() * sizeof(BVHNode);
+
+	cout << "\t" << name << ": " << bvh.nodes().size() << " binary nodes ("
+		 << binaryBytes / 1024.0 << " KiB), " << wideBVH.numNodes() << " wide nodes ("
+		 << wideBVH.memoryBytes() / 1024.0 << " KiB)" << endl;
+}
+
+// Node footprint of the scene's hierarchy and of every distinct mesh's
+static void printHierarchyMemory(const CompiledScene &scene, const SceneBVH *sceneBVH)
+{
+	cout << "Hierarchy memory: " << endl;
+
+	if(sceneBVH)
+		printHierarchyMemory("scene", sceneBVH->bvh(), sceneBVH->wideBVH());
+
+	// Meshes are shared between instances, count each once
+	set<const Mesh *> meshes;
+	for(const auto &instance : scene.instances()){
+		if(const Mesh *mesh = dynamic_cast<const Mesh *>(instance.primitive))
+			meshes.insert(mesh);
+	}
+
+	size_t binaryNodes = 0, wideNodes = 0;
+	size_t binaryBytes = 0, wideBytes = 0;
+	for(const Mesh *mesh : meshes){
+		binaryNodes += mesh->bvh().nodes().size();
+		binaryBytes += mesh->bvh().nodes().size() * sizeof(BVHNode);
+		wideNodes += mesh->wideBVH().numNodes();
+		wideBytes += mesh->wideBVH().memoryBytes();
+	}
+
+	if(!meshes.empty()){
+		cout << "\t" << meshes.size() << " meshes: " << binaryNodes << " binary nodes ("
+			 << binaryBytes / 1024.0 << " KiB), " << wideNodes << " wide nodes ("
+			 << wideBytes / 1024.0 << " KiB)" << endl;
 	}
 }
 
@@ -288,7 +1094,16 @@ void A4_Render(
 
 		// Lighting parameters  
 		const vec3 & ambient,
-		const list<Light *> & lights
+		const list<Light *> & lights,
+
+		// Render settings
+		const RenderSettings & settings,
+
+		// When the scene started loading
+		chrono::steady_clock::time_point sceneStart,
+
+		// Per pixel cost in the first component, if not null
+		Image * costs
 ) {
 	// Fill in raytracing code here...  
 	cout << "Calling A4_Render(\n" <<
@@ -322,56 +1137,37 @@ void A4_Render(
 	const vec4 eye4D(eye, 1);
 
 	/* Ray Trace image */
-	printRenderingOptions();
+	cout << settings;
 
-	// Start rendering!
-	{
-		Timer timer;
-
-		uint pixelsRendered = 0;
-
-#ifdef ENABLE_MULTITHREADING
-		const uint numWorkers = CONCURRENCY;
-		const uint chunkSize = 1 + ((n_x - 1) / numWorkers);
-
-		cout << endl << "Multithreading settings: " << endl;
-			cout << "\t" << numWorkers << " workers" << endl;
-			cout << "\t~" << chunkSize << " columns/worker" << endl;
-
-		std::vector<std::future<void>> workers;
-		workers.reserve(numWorkers);
-
-		uint xStart = 0;
-		uint xEnd = chunkSize;
-
-		// Chunk the image and launch workers
-		for(uint chunk = 0; chunk < numWorkers; ++chunk) {
-			xStart = chunk * chunkSize;
-			xEnd = chunk < numWorkers - 1 ? xStart + chunkSize : n_x;
-
-			workers.push_back(std::async(
-				// Type
-				std::launch::async,
-
-				// Function
-				renderChunk,
-
-				// Parameters
-				std::ref(pixelDim),
-				xStart, xEnd,
-				std::ref(image),
-				root,
-				std::ref(dcsToWorld),
-				std::ref(eye4D),
-				std::ref(ambient),
-				std::ref(lights),
-				std::ref(pixelsRendered)
-			));
-		}
+	// Cull lights by their falloff, see LightBVH.hpp
+	const LightBVH lightBVH(lights, settings.lightCutoff);
+	if(settings.lightCutoff > 0.0){
+		cout << "Lights: " << lightBVH.numLights() << " (" << lightBVH.numBounded() << " culled by distance, "
+			 << lightBVH.numUnbounded() << " unbounded, " << lightBVH.numDark() << " below the cutoff)" << endl;
+	}
+
+	// Compile the scene graph into a flat instance table (and build the
+	// acceleration structure over it), then start rendering!
+	const auto compileStart = chrono::steady_clock::now();
+	auto compileMs = [&]() {
+		return chrono::duration<double, milli>(chrono::steady_clock::now() - compileStart).count();
+	};
+
+	if(settings.sceneBVH){
+		const SceneBVH scene(root, settings);
+
+		cout << "Compiled " << scene.numNodes() << " scene nodes into "
+			 << scene.numInstances() << " instances in " << compileMs() << "ms" << endl;
+		printHierarchyMemory(scene, &scene);
+
+		renderScene(&scene, image, costs, dcsToWorld, eye4D, ambient, lightBVH, settings, sceneStart);
+	} else {
+		const CompiledScene scene(root, settings);
+
+		cout << "Compiled " << scene.numNodes() << " scene nodes into "
+			 << scene.numInstances() << " instances in " << compileMs() << "ms" << endl;
+		printHierarchyMemory(scene, nullptr);
 
-#else
-		for(uint x = 0; x < n_x; ++x)
-			renderChunk(pixelDim, x, x+1, image, root, dcsToWorld, eye4D, ambient, lights, pixelsRendered);
-#endif
+		renderScene(&scene, image, costs, dcsToWorld, eye4D, ambient, lightBVH, settings, sceneStart);
 	}
 }
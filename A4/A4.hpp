@@ -4,13 +4,17 @@
 
 #include <glm/glm.hpp>
 #include <limits>
+#include <chrono>
 
 #include "Options.hpp"
 #include "SceneNode.hpp"
 #include "Light.hpp"
+#include "LightBVH.hpp"
 #include "Ray.hpp"
 #include "Image.hpp"
-
+#include "RenderSettings.hpp"
+#include "CompiledScene.hpp"
+#include "SceneBVH.hpp"
 
 const glm::vec3 ZenithColour(0.0f, 0.0f, 0.35f);
 const glm::vec3 DuskColour(0.902f, 0.514f, 0.071f);
@@ -21,10 +25,6 @@ enum Cone {
 	B
 };
 
-#ifndef MAX_HITS
-const uint MAX_HITS = 1;
-#endif
-
 glm::mat4 generateDCStoWorldMat(
 	// Pixel dimensions, (n_x, n_y)
 	const std::pair<size_t, size_t> &pixelDim,
@@ -36,21 +36,27 @@ glm::mat4 generateDCStoWorldMat(
 	const double fovy
 );
 
+// Kernels are instantiated for each scene type (CompiledScene or SceneBVH),
+// with/without reflections and with/without the shadow cache, see A4.cpp
+template<typename SceneT, bool Reflections, bool CacheShadows>
 glm::vec3 rayColour(
-	SceneNode *node, 
-	const Ray &r, 
+	const SceneT *scene,
+	const Ray &r,
 	const glm::vec3 &ambient,
-	const std::list<Light *> &lights,
-	const uint hitsLeft = MAX_HITS
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	const uint hitsLeft
 );
 
+template<typename SceneT, bool Reflections, bool CacheShadows>
 glm::vec3 directColour(
-	SceneNode *node,
+	const SceneT *scene,
 	const Ray &primRay,
 	const HitRecord &primRec,
 	const glm::vec3 &ambient,
-	const std::list<Light *> &lights,
-	const uint hitsLeft = MAX_HITS
+	const LightBVH &lights,
+	const RenderSettings &settings,
+	const uint hitsLeft
 );
 
 void A4_Render(
@@ -68,5 +74,15 @@ void A4_Render(
 
 		// Lighting parameters
 		const glm::vec3 & ambient,
-		const std::list<Light *> & lights
+		const std::list<Light *> & lights,
+
+		// Render settings (defaults from Options.hpp)
+		const RenderSettings & settings = RenderSettings(),
+
+		// When the scene started loading, for time to first tile
+		std::chrono::steady_clock::time_point sceneStart = std::chrono::steady_clock::now(),
+
+		// Where to record each pixel's cost (settings.heatmap), the same size
+		// as image, or null
+		Image * costs = nullptr
 );
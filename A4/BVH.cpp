@@ -0,0 +1,401 @@
+// Spring 2020
+
+#include "BVH.hpp"
+#include "Epsilon.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+// Number of SAH buckets per axis
+static const uint32_t NUM_BUCKETS = 12;
+
+// Relative cost of traversing a node vs. intersecting a primitive
+static const float TRAVERSAL_COST = 0.125f;
+
+// Smallest subtree worth building as a separate task
+static const uint32_t MIN_PARALLEL_PRIMS = 4096;
+
+// Median splits needed before count primitives fit in one leaf, whose
+// count is a uint16_t
+static uint32_t oversizeLevels(uint32_t count)
+{
+	uint32_t levels = 0;
+	for(uint32_t n = count; n > UINT16_MAX; n = n / 2 + n % 2)
+		++levels;
+	return levels;
+}
+
+thread_local TraversalCounters traversalCounters;
+
+TraversalCounters &TraversalCounters::operator+=(const TraversalCounters &other)
+{
+	rays += other.rays;
+	nodes += other.nodes;
+	boxTests += other.boxTests;
+	triangleTests += other.triangleTests;
+	primaryRays += other.primaryRays;
+	shadowRays += other.shadowRays;
+	reflectionRays += other.reflectionRays;
+	shadowCacheHits += other.shadowCacheHits;
+	cacheReferences += other.cacheReferences;
+	cacheMisses += other.cacheMisses;
+	return *this;
+}
+
+TraversalCounters TraversalCounters::operator-(const TraversalCounters &other) const
+{
+	TraversalCounters result;
+	result.rays = rays - other.rays;
+	result.nodes = nodes - other.nodes;
+	result.boxTests = boxTests - other.boxTests;
+	result.triangleTests = triangleTests - other.triangleTests;
+	result.primaryRays = primaryRays - other.primaryRays;
+	result.shadowRays = shadowRays - other.shadowRays;
+	result.reflectionRays = reflectionRays - other.reflectionRays;
+	result.shadowCacheHits = shadowCacheHits - other.shadowCacheHits;
+	result.cacheReferences = cacheReferences - other.cacheReferences;
+	result.cacheMisses = cacheMisses - other.cacheMisses;
+	return result;
+}
+
+// ------------------------------------------------------------
+// AABB
+AABB::AABB()
+	: min(INF_FLOAT), max(-INF_FLOAT)
+{}
+
+AABB::AABB(const vec3 &min, const vec3 &max)
+	: min(min), max(max)
+{}
+
+void AABB::expand(const vec3 &p)
+{
+	min = glm::min(min, p);
+	max = glm::max(max, p);
+}
+
+void AABB::expand(const AABB &other)
+{
+	min = glm::min(min, other.min);
+	max = glm::max(max, other.max);
+}
+
+AABB AABB::transform(const mat4 &M) const
+{
+	AABB result;
+	if(empty())
+		return result;
+
+	for(int corner = 0; corner < 8; ++corner){
+		const vec4 p(
+			(corner & 1) ? max.x : min.x,
+			(corner & 2) ? max.y : min.y,
+			(corner & 4) ? max.z : min.z,
+			1.0f
+		);
+		result.expand(vec3(M * p));
+	}
+
+	return result;
+}
+
+vec3 AABB::centroid() const
+{
+	return (min + max) * 0.5f;
+}
+
+float AABB::surfaceArea() const
+{
+	if(empty())
+		return 0.0f;
+
+	const vec3 d = max - min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool AABB::empty() const
+{
+	return max.x < min.x || max.y < min.y || max.z < min.z;
+}
+
+bool AABB::hit(const vec3 &origin, const vec3 &invDir, double t0, double t1) const
+{
+	float tMin = float(t0);
+	float tMax = float(t1);
+
+	for(int axis = 0; axis < 3; ++axis){
+		float tNear = (min[axis] - origin[axis]) * invDir[axis];
+		float tFar = (max[axis] - origin[axis]) * invDir[axis];
+
+		if(tNear > tFar)
+			std::swap(tNear, tFar);
+
+		// Written so that NaNs (0 * inf) leave the interval untouched
+		tMin = tNear > tMin ? tNear : tMin;
+		tMax = tFar < tMax ? tFar : tMax;
+
+		if(tMin > tMax)
+			return false;
+	}
+
+	return true;
+}
+
+
+// ------------------------------------------------------------
+// BVH
+const uint32_t BVH::MAX_DEPTH;
+const uint32_t BVH::MAX_LEAF_SIZE;
+const uint32_t BVH::INVALID_INDEX;
+
+BVH::BVH()
+	: m_nodes(), m_indices(), m_blockSize(1), m_parallelDepth(0)
+{}
+
+void BVH::build(const vector<AABB> &primBounds, uint32_t blockSize, uint32_t numThreads)
+{
+	m_nodes.clear();
+	m_indices.clear();
+	m_blockSize = std::max(blockSize, 1u);
+
+	// A few more tasks than threads, since the SAH rarely splits evenly
+	m_parallelDepth = 0;
+	if(numThreads > 1){
+		while((1u << m_parallelDepth) < numThreads)
+			++m_parallelDepth;
+		m_parallelDepth += 2;
+
+		ThreadPool::shared().reserve(numThreads - 1);
+	}
+
+	if(primBounds.empty())
+		return;
+
+	vector<BuildPrim> prims(primBounds.size());
+	for(uint32_t i = 0; i < prims.size(); ++i){
+		prims[i].bounds = primBounds[i];
+		prims[i].centroid = primBounds[i].centroid();
+		prims[i].index = i;
+	}
+
+	BuildOutput out;
+	out.nodes.reserve(2 * prims.size());
+	out.indices.reserve(prims.size());
+
+	buildRecursive(prims, 0, prims.size(), 0, out);
+
+	m_nodes = std::move(out.nodes);
+	m_indices = std::move(out.indices);
+	m_nodes.shrink_to_fit();
+}
+
+void BVH::assign(vector<BVHNode> &&nodes, vector<uint32_t> &&indices, uint32_t blockSize)
+{
+	m_nodes = std::move(nodes);
+	m_indices = std::move(indices);
+	m_blockSize = std::max(blockSize, 1u);
+}
+
+uint32_t BVH::makeLeaf(vector<BuildPrim> &prims, uint32_t start, uint32_t end, const AABB &bounds, BuildOutput &out) const
+{
+	const uint32_t nodeIndex = out.nodes.size();
+
+	BVHNode node;
+	node.bounds = bounds;
+	node.offset = out.indices.size();
+	node.count = end - start;
+	node.axis = 0;
+	node.pad = 0;
+
+	for(uint32_t i = start; i < end; ++i)
+		out.indices.push_back(prims[i].index);
+
+	// Start the next leaf on a block boundary
+	while(out.indices.size() % m_blockSize != 0)
+		out.indices.push_back(INVALID_INDEX);
+
+	out.nodes.push_back(node);
+	return nodeIndex;
+}
+
+uint32_t BVH::buildRecursive(vector<BuildPrim> &prims, uint32_t start, uint32_t end, uint32_t depth, BuildOutput &out) const
+{
+	const uint32_t count = end - start;
+
+	// Bounds of all primitives and of their centroids
+	AABB bounds, centroidBounds;
+	for(uint32_t i = start; i < end; ++i){
+		bounds.expand(prims[i].bounds);
+		centroidBounds.expand(prims[i].centroid);
+	}
+
+	// Near the depth limit, keep just enough levels to median split ranges
+	// too big for one leaf. Each median split takes one level off, so the
+	// leaves stay above MAX_DEPTH.
+	const uint32_t oversize = oversizeLevels(count);
+	const bool depthLimit = depth + 1 + oversize >= MAX_DEPTH;
+
+	if(count <= std::max(MAX_LEAF_SIZE, m_blockSize) || (depthLimit && oversize == 0))
+		return makeLeaf(prims, start, end, bounds, out);
+
+	// Split along the axis with the largest centroid extent
+	const vec3 extent = centroidBounds.max - centroidBounds.min;
+	uint8_t axis = 0;
+	if(extent.y > extent[axis]) axis = 1;
+	if(extent.z > extent[axis]) axis = 2;
+
+	// All centroids coincide, no split will separate them
+	if(extent[axis] <= 0.0f && oversize == 0)
+		return makeLeaf(prims, start, end, bounds, out);
+
+	// Bin primitives by centroid
+	struct Bucket {
+		uint32_t count = 0;
+		AABB bounds;
+	} buckets[NUM_BUCKETS];
+
+	const float axisMin = centroidBounds.min[axis];
+	const float binScale = extent[axis] > 0.0f ? NUM_BUCKETS / extent[axis] : 0.0f;
+
+	auto bucketOf = [&](const BuildPrim &prim) {
+		uint32_t b = uint32_t((prim.centroid[axis] - axisMin) * binScale);
+		return b < NUM_BUCKETS ? b : NUM_BUCKETS - 1;
+	};
+
+	for(uint32_t i = start; i < end; ++i){
+		Bucket &bucket = buckets[bucketOf(prims[i])];
+		++bucket.count;
+		bucket.bounds.expand(prims[i].bounds);
+	}
+
+	// Sweep from the right to accumulate suffix areas, then from the left to
+	// evaluate the cost of splitting after each bucket
+	float rightArea[NUM_BUCKETS];
+	uint32_t rightCount[NUM_BUCKETS];
+	{
+		AABB acc;
+		uint32_t n = 0;
+		for(int b = NUM_BUCKETS - 1; b > 0; --b){
+			acc.expand(buckets[b].bounds);
+			n += buckets[b].count;
+			rightArea[b] = acc.surfaceArea();
+			rightCount[b] = n;
+		}
+	}
+
+	float bestCost = INF_FLOAT;
+	uint32_t bestSplit = 0;
+	{
+		AABB acc;
+		uint32_t n = 0;
+		for(uint32_t b = 0; b < NUM_BUCKETS - 1; ++b){
+			acc.expand(buckets[b].bounds);
+			n += buckets[b].count;
+
+			if(n == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			const float cost = intersectionCost(n) * acc.surfaceArea()
+				+ intersectionCost(rightCount[b + 1]) * rightArea[b + 1];
+			if(cost < bestCost){
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Compare against the cost of not splitting at all
+	const float invArea = 1.0f / bounds.surfaceArea();
+	const float splitCost = TRAVERSAL_COST + bestCost * invArea;
+	const float leafCost = intersectionCost(count);
+
+	uint32_t mid;
+	if(!depthLimit && bestCost < INF_FLOAT && (splitCost < leafCost || count > UINT16_MAX)){
+		auto midIt = std::partition(prims.begin() + start, prims.begin() + end,
+			[&](const BuildPrim &prim) { return bucketOf(prim) <= bestSplit; });
+		mid = midIt - prims.begin();
+	} else if(oversize == 0){
+		return makeLeaf(prims, start, end, bounds, out);
+	} else {
+		// Fall back to a median split, which always halves the range
+		mid = start + count / 2;
+		std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+			[&](const BuildPrim &a, const BuildPrim &b) { return a.centroid[axis] < b.centroid[axis]; });
+	}
+
+	// Interior node, its first child directly follows it
+	const uint32_t nodeIndex = out.nodes.size();
+	out.nodes.push_back(BVHNode());
+
+	uint32_t secondChild;
+	if(depth < m_parallelDepth && count >= MIN_PARALLEL_PRIMS){
+		// The children cover disjoint ranges of prims, build the second one
+		// on its own while this thread builds the first
+		BuildOutput subtree;
+		ThreadPool::Task task = ThreadPool::shared().submit([&]() {
+			buildRecursive(prims, mid, end, depth + 1, subtree);
+		});
+
+		buildRecursive(prims, start, mid, depth + 1, out);
+		task.wait();
+
+		secondChild = splice(out, subtree);
+	} else {
+		buildRecursive(prims, start, mid, depth + 1, out);
+		secondChild = buildRecursive(prims, mid, end, depth + 1, out);
+	}
+
+	BVHNode &node = out.nodes[nodeIndex];
+	node.bounds = bounds;
+	node.offset = secondChild;
+	node.count = 0;
+	node.axis = axis;
+	node.pad = 0;
+
+	return nodeIndex;
+}
+
+uint32_t BVH::splice(BuildOutput &out, const BuildOutput &subtree)
+{
+	const uint32_t nodeBase = out.nodes.size();
+	const uint32_t indexBase = out.indices.size();
+
+	// Leaves start on block boundaries of both arrays, so they still do
+	for(BVHNode node : subtree.nodes){
+		node.offset += node.count > 0 ? indexBase : nodeBase;
+		out.nodes.push_back(node);
+	}
+
+	out.indices.insert(out.indices.end(), subtree.indices.begin(), subtree.indices.end());
+	return nodeBase;
+}
+
+float BVH::intersectionCost(uint32_t count) const
+{
+	return float((count + m_blockSize - 1) / m_blockSize);
+}
+
+const vector<uint32_t> &BVH::indices() const
+{
+	return m_indices;
+}
+
+const vector<BVHNode> &BVH::nodes() const
+{
+	return m_nodes;
+}
+
+const AABB &BVH::bounds() const
+{
+	return m_nodes.front().bounds;
+}
+
+bool BVH::empty() const
+{
+	return m_nodes.empty();
+}
@@ -0,0 +1,341 @@
+// Spring 2020
+
+#pragma once
+
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// ------------------------------------------------------------
+// Per thread traversal statistics: rays traced through the scene and
+// hierarchy nodes visited on their behalf, and shadow rays settled by the
+// blocker of an earlier one (see A4.cpp) without traversing anything.
+// Workers publish them to Telemetry after every tile.
+struct TraversalCounters {
+	uint64_t rays = 0;
+	uint64_t nodes = 0;
+	uint64_t boxTests = 0;      // Bounding boxes tested, a packet counts once
+	uint64_t triangleTests = 0; // Ray-triangle tests, SIMD lanes included
+	uint64_t primaryRays = 0;
+	uint64_t shadowRays = 0;
+	uint64_t reflectionRays = 0;
+	uint64_t shadowCacheHits = 0;
+	uint64_t cacheReferences = 0; // Last level cache, with cache_counters only
+	uint64_t cacheMisses = 0;
+
+	TraversalCounters &operator+=(const TraversalCounters &other);
+	TraversalCounters operator-(const TraversalCounters &other) const;
+};
+
+extern thread_local TraversalCounters traversalCounters;
+
+// ------------------------------------------------------------
+// Axis-aligned bounding box
+struct AABB {
+	AABB();
+	AABB(const glm::vec3 &min, const glm::vec3 &max);
+
+	void expand(const glm::vec3 &p);
+	void expand(const AABB &other);
+
+	// Bounds of this box after applying the affine transform M
+	AABB transform(const glm::mat4 &M) const;
+
+	glm::vec3 centroid() const;
+	float surfaceArea() const;
+	bool empty() const;
+
+	// Slab test against [t0, t1], invDir is 1 / ray direction
+	bool hit(const glm::vec3 &origin, const glm::vec3 &invDir, double t0, double t1) const;
+
+	// Slab test for every lane of a packet against [tMin, tMax]
+	vmask hit(const RayPacket &packet) const;
+
+	// Whether p is inside the box or on its boundary
+	bool contains(const glm::vec3 &p) const;
+
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// ------------------------------------------------------------
+// Flattened BVH node (32 bytes), stored in depth-first order so the
+// first child of an interior node always directly follows it
+struct BVHNode {
+	AABB bounds;
+	uint32_t offset; // Leaf: index of first primitive, Interior: index of second child
+	uint16_t count;  // Number of primitives in leaf, 0 for interior nodes
+	uint8_t axis;    // Split axis of interior nodes
+	uint8_t pad;
+};
+
+// ------------------------------------------------------------
+// Bounding volume hierarchy built using the surface area heuristic
+// (Physically Based Rendering 4.3)
+class BVH {
+public:
+	BVH();
+
+	// Build the hierarchy over the given primitive bounds. Afterwards, indices()
+	// holds the primitive order expected by the leaves.
+	//
+	// Primitives intersected blockSize at a time (e.g. SIMD triangle blocks)
+	// are charged per block by the SAH, and every leaf starts on a block
+	// boundary of indices(), padded with INVALID_INDEX.
+	//
+	// With numThreads > 1, large subtrees near the root are built as
+	// separate tasks and spliced together, giving the same tree.
+	void build(const std::vector<AABB> &primBounds, uint32_t blockSize = 1, uint32_t numThreads = 1);
+
+	// Adopt a hierarchy built earlier with the given block size (e.g. one
+	// loaded from MeshCache)
+	void assign(std::vector<BVHNode> &&nodes, std::vector<uint32_t> &&indices, uint32_t blockSize);
+
+	const std::vector<uint32_t> &indices() const;
+	const std::vector<BVHNode> &nodes() const;
+	const AABB &bounds() const;
+	bool empty() const;
+
+	// Traverse the hierarchy front to back, calling leafHit(first, count, t1) on
+	// every leaf the ray reaches. leafHit returns true (and shrinks t1) if it
+	// found a closer intersection, nodes beyond t1 are skipped.
+	template<typename LeafFn>
+	bool hit(const Ray &r, double t0, double &t1, LeafFn &&leafHit) const;
+
+	// Any-hit traversal, stops as soon as leafOccluded(first, count) returns true
+	template<typename LeafFn>
+	bool occluded(const Ray &r, double t0, double t1, LeafFn &&leafOccluded) const;
+
+	// Packet traversal, calling leafHit(first, count, mask) with the lanes that
+	// reach each leaf. leafHit shrinks packet.tMax as it finds closer hits.
+	// Children are visited in the order of the first active ray.
+	template<typename LeafFn>
+	void hitPacket(RayPacket &packet, LeafFn &&leafHit) const;
+
+	// Call leafFn(first, count) on every leaf whose bounds contain point
+	template<typename LeafFn>
+	void query(const glm::vec3 &point, LeafFn &&leafFn) const;
+
+	static const uint32_t MAX_DEPTH = 64;
+	static const uint32_t MAX_LEAF_SIZE = 4;
+	static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+private:
+	struct BuildPrim {
+		AABB bounds;
+		glm::vec3 centroid;
+		uint32_t index;
+	};
+
+	// Nodes and indices of a subtree, offsets relative to its own arrays
+	struct BuildOutput {
+		std::vector<BVHNode> nodes;
+		std::vector<uint32_t> indices;
+	};
+
+	uint32_t buildRecursive(std::vector<BuildPrim> &prims, uint32_t start, uint32_t end, uint32_t depth, BuildOutput &out) const;
+	uint32_t makeLeaf(std::vector<BuildPrim> &prims, uint32_t start, uint32_t end, const AABB &bounds, BuildOutput &out) const;
+
+	// Append a subtree built separately, returns the index of its root
+	static uint32_t splice(BuildOutput &out, const BuildOutput &subtree);
+
+	// Cost of intersecting count primitives
+	float intersectionCost(uint32_t count) const;
+
+	std::vector<BVHNode> m_nodes;
+	std::vector<uint32_t> m_indices;
+	uint32_t m_blockSize;
+	uint32_t m_parallelDepth; // Nodes above this depth build their second child as a task
+};
+
+template<typename LeafFn>
+bool BVH::hit(const Ray &r, double t0, double &t1, LeafFn &&leafHit) const
+{
+	if(m_nodes.empty())
+		return false;
+
+	const glm::vec3 origin(r.origin);
+	const glm::vec3 invDir = 1.0f / glm::vec3(r.direction);
+	const bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	uint32_t stack[MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+	bool hit = false;
+
+	while(true){
+		const BVHNode &node = m_nodes[current];
+		++traversalCounters.nodes;
+		++traversalCounters.boxTests;
+
+		if(node.bounds.hit(origin, invDir, t0, t1)){
+			if(node.count > 0){
+				if(leafHit(node.offset, node.count, t1))
+					hit = true;
+			} else {
+				// Visit the near child first, push the far child
+				if(dirIsNeg[node.axis]){
+					stack[stackSize++] = current + 1;
+					current = node.offset;
+				} else {
+					stack[stackSize++] = node.offset;
+					current = current + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stackSize == 0)
+			break;
+
+		current = stack[--stackSize];
+	}
+
+	return hit;
+}
+
+template<typename LeafFn>
+bool BVH::occluded(const Ray &r, double t0, double t1, LeafFn &&leafOccluded) const
+{
+	if(m_nodes.empty())
+		return false;
+
+	const glm::vec3 origin(r.origin);
+	const glm::vec3 invDir = 1.0f / glm::vec3(r.direction);
+	const bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	uint32_t stack[MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+
+	while(true){
+		const BVHNode &node = m_nodes[current];
+		++traversalCounters.nodes;
+		++traversalCounters.boxTests;
+
+		if(node.bounds.hit(origin, invDir, t0, t1)){
+			if(node.count > 0){
+				if(leafOccluded(node.offset, node.count))
+					return true;
+			} else {
+				if(dirIsNeg[node.axis]){
+					stack[stackSize++] = current + 1;
+					current = node.offset;
+				} else {
+					stack[stackSize++] = node.offset;
+					current = current + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stackSize == 0)
+			break;
+
+		current = stack[--stackSize];
+	}
+
+	return false;
+}
+
+template<typename LeafFn>
+void BVH::hitPacket(RayPacket &packet, LeafFn &&leafHit) const
+{
+	if(m_nodes.empty() || packet.active.none())
+		return;
+
+	const uint32_t lane = packet.firstActive();
+	const bool dirIsNeg[3] = { packet.dx[lane] < 0, packet.dy[lane] < 0, packet.dz[lane] < 0 };
+
+	uint32_t stack[MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+
+	while(true){
+		const BVHNode &node = m_nodes[current];
+		++traversalCounters.nodes;
+		++traversalCounters.boxTests;
+
+		const vmask mask = node.bounds.hit(packet) & packet.active;
+
+		if(mask.any()){
+			if(node.count > 0){
+				leafHit(node.offset, node.count, mask);
+			} else {
+				if(dirIsNeg[node.axis]){
+					stack[stackSize++] = current + 1;
+					current = node.offset;
+				} else {
+					stack[stackSize++] = node.offset;
+					current = current + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stackSize == 0)
+			break;
+
+		current = stack[--stackSize];
+	}
+}
+
+template<typename LeafFn>
+void BVH::query(const glm::vec3 &point, LeafFn &&leafFn) const
+{
+	if(m_nodes.empty())
+		return;
+
+	uint32_t stack[MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+
+	while(true){
+		const BVHNode &node = m_nodes[current];
+
+		if(node.bounds.contains(point)){
+			if(node.count > 0){
+				leafFn(node.offset, node.count);
+			} else {
+				stack[stackSize++] = node.offset;
+				current = current + 1;
+				continue;
+			}
+		}
+
+		if(stackSize == 0)
+			break;
+
+		current = stack[--stackSize];
+	}
+}
+
+inline bool AABB::contains(const glm::vec3 &p) const
+{
+	return p.x >= min.x && p.y >= min.y && p.z >= min.z
+		&& p.x <= max.x && p.y <= max.y && p.z <= max.z;
+}
+
+inline vmask AABB::hit(const RayPacket &packet) const
+{
+	// Same as the single ray test, for every lane at once
+	const vfloat nearX = (vfloat(min.x) - packet.ox) * packet.invDx;
+	const vfloat farX = (vfloat(max.x) - packet.ox) * packet.invDx;
+	const vfloat nearY = (vfloat(min.y) - packet.oy) * packet.invDy;
+	const vfloat farY = (vfloat(max.y) - packet.oy) * packet.invDy;
+	const vfloat nearZ = (vfloat(min.z) - packet.oz) * packet.invDz;
+	const vfloat farZ = (vfloat(max.z) - packet.oz) * packet.invDz;
+
+	vfloat tMin = ::max(::min(nearX, farX), packet.tMin);
+	vfloat tMax = ::min(::max(nearX, farX), packet.tMax);
+	tMin = ::max(::min(nearY, farY), tMin);
+	tMax = ::min(::max(nearY, farY), tMax);
+	tMin = ::max(::min(nearZ, farZ), tMin);
+	tMax = ::min(::max(nearZ, farZ), tMax);
+
+	return tMin <= tMax;
+}
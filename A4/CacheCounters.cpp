@@ -0,0 +1,70 @@
+// Spring 2020
+
+#include "CacheCounters.hpp"
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+// User space hardware event of the calling thread on any CPU, or -1
+static int openCounter(uint64_t config)
+{
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// A thread's counters, closed when it exits
+struct ThreadCounters {
+	int references;
+	int misses;
+
+	ThreadCounters()
+		: references(openCounter(PERF_COUNT_HW_CACHE_REFERENCES)),
+		  misses(openCounter(PERF_COUNT_HW_CACHE_MISSES))
+	{}
+
+	~ThreadCounters()
+	{
+		if(references >= 0)
+			close(references);
+		if(misses >= 0)
+			close(misses);
+	}
+};
+
+bool CacheCounters::read(CacheCounts &counts)
+{
+	static thread_local ThreadCounters counters;
+
+	if(counters.references < 0 || counters.misses < 0)
+		return false;
+
+	uint64_t references, misses;
+	if(::read(counters.references, &references, sizeof(references)) != sizeof(references) ||
+	   ::read(counters.misses, &misses, sizeof(misses)) != sizeof(misses))
+		return false;
+
+	counts.references = references;
+	counts.misses = misses;
+	return true;
+}
+
+#else
+
+bool CacheCounters::read(CacheCounts &)
+{
+	return false;
+}
+
+#endif
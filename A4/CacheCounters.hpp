@@ -0,0 +1,24 @@
+// Spring 2020
+
+#pragma once
+
+#include <cstdint>
+
+// Last level cache references and misses of one thread
+struct CacheCounts {
+	uint64_t references = 0;
+	uint64_t misses = 0;
+};
+
+// ------------------------------------------------------------
+// Hardware cache counters of the calling thread, from Linux perf events.
+// Each thread opens its own counters the first time it reads them, and
+// keeps them open until it exits. Unavailable on other platforms, in VMs
+// without performance counters, or when kernel.perf_event_paranoid
+// forbids them.
+class CacheCounters {
+public:
+	// Counts of the calling thread since its counters were opened. Returns
+	// false if they can't be read.
+	static bool read(CacheCounts &counts);
+};
@@ -0,0 +1,166 @@
+// Spring 2020
+
+#include "CompiledScene.hpp"
+#include "GeometryNode.hpp"
+
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+// ------------------------------------------------------------
+// Instance
+void Instance::toWorld(HitRecord &rec) const
+{
+	rec.point = modelToWorld * rec.point;
+	rec.n = normalMatrix * rec.n;
+	rec.mat = material;
+	rec.name = name;
+}
+
+
+// ------------------------------------------------------------
+// CompiledScene
+CompiledScene::CompiledScene(const SceneNode *root, const RenderSettings &settings)
+	: m_instances(), m_numNodes(0)
+{
+	compile(root, mat4(), settings);
+	m_instances.shrink_to_fit();
+}
+
+void CompiledScene::compile(const SceneNode *node, const mat4 &parentToWorld, const RenderSettings &settings)
+{
+	++m_numNodes;
+
+	// Fold this node's transform into everything below it
+	const mat4 modelToWorld = parentToWorld * node->trans;
+
+	if(node->m_nodeType == NodeType::GeometryNode){
+		const GeometryNode *geometryNode = static_cast<const GeometryNode *>(node);
+
+		// Meshes shared between instances are prepared again, which is harmless
+		if(geometryNode->m_primitive)
+			geometryNode->m_primitive->prepare(settings);
+
+		Instance instance;
+		instance.primitive = geometryNode->m_primitive;
+		instance.material = geometryNode->m_material;
+		instance.name = &node->m_name;
+		instance.modelToWorld = modelToWorld;
+		instance.worldToModel = glm::inverse(modelToWorld);
+		instance.normalMatrix = mat4(glm::transpose(mat3(instance.worldToModel)));
+		instance.bounds = instance.primitive
+			? instance.primitive->bounds().transform(modelToWorld)
+			: AABB();
+
+		// Primitives without a surface can never be hit
+		if(!instance.bounds.empty())
+			m_instances.push_back(instance);
+	}
+
+	for(const auto child : node->children)
+		compile(child, modelToWorld, settings);
+}
+
+RayHit CompiledScene::intersect(const Ray &r, double t0, double t1) const
+{
+	RayHit hit;
+	++traversalCounters.rays;
+
+	for(uint32_t idx = 0; idx < m_instances.size(); ++idx){
+		const Instance &instance = m_instances[idx];
+		if(instance.primitive->intersect(instance.worldToModel * r, t0, t1, hit.primitive)){
+			hit.t = t1;
+			hit.instance = idx;
+		}
+	}
+
+	return hit;
+}
+
+HitRecord CompiledScene::surface(const Ray &r, const RayHit &hit) const
+{
+	HitRecord rec;
+	if(!hit)
+		return rec;
+
+	const Instance &instance = m_instances[hit.instance];
+
+	rec.hit = true;
+	rec.t = hit.t;
+	instance.primitive->surface(instance.worldToModel * r, hit.t, hit.primitive, rec);
+	instance.toWorld(rec);
+
+	return rec;
+}
+
+bool CompiledScene::occluded(const Ray &r, double t0, double t1, uint32_t *blocker) const
+{
+	++traversalCounters.rays;
+
+	for(uint32_t idx = 0; idx < m_instances.size(); ++idx){
+		if(occludedBy(idx, r, t0, t1)){
+			if(blocker)
+				*blocker = idx;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CompiledScene::occludedBy(uint32_t instance, const Ray &r, double t0, double t1) const
+{
+	const Instance &blocker = m_instances[instance];
+	return blocker.primitive->occluded(blocker.worldToModel * r, t0, t1);
+}
+
+void CompiledScene::intersectPacket(RayPacket &packet, RayHit *hits) const
+{
+	traversalCounters.rays += __builtin_popcount(packet.active.bits());
+	intersectInstances(0, m_instances.size(), packet.active, packet, hits);
+}
+
+void CompiledScene::intersectInstances(uint32_t first, uint32_t count, const vmask &mask, RayPacket &packet, RayHit *hits) const
+{
+	uint32_t ids[SIMD_WIDTH];
+
+	for(uint32_t idx = first; idx < first + count; ++idx){
+		const Instance &instance = m_instances[idx];
+
+		// Cull by the world space bounds before transforming the packet
+		const vmask reached = instance.bounds.hit(packet) & mask;
+		++traversalCounters.boxTests;
+		if(reached.none())
+			continue;
+
+		RayPacket local = packet.transform(instance.worldToModel);
+		local.active = reached;
+
+		const vmask hit = instance.primitive->intersectPacket(local, ids);
+		if(hit.none())
+			continue;
+
+		packet.tMax = local.tMax;
+		forEachLane(hit, [&](uint lane) {
+			hits[lane].t = local.tMax[lane];
+			hits[lane].primitive = ids[lane];
+			hits[lane].instance = idx;
+		});
+	}
+}
+
+const vector<Instance> &CompiledScene::instances() const
+{
+	return m_instances;
+}
+
+size_t CompiledScene::numInstances() const
+{
+	return m_instances.size();
+}
+
+size_t CompiledScene::numNodes() const
+{
+	return m_numNodes;
+}
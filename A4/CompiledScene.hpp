@@ -0,0 +1,78 @@
+// Spring 2020
+
+#pragma once
+
+#include "SceneNode.hpp"
+#include "Primitive.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "RenderSettings.hpp"
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// A GeometryNode placed in world space. Meshes loaded through gr.mesh are
+// shared between instances, only the transforms differ.
+struct Instance {
+	const Primitive *primitive;
+	Material *material;
+	std::string const *name;
+
+	glm::mat4 modelToWorld;
+	glm::mat4 worldToModel;
+	glm::mat4 normalMatrix; // 3x3 transpose of worldToModel
+
+	AABB bounds; // World space bounds
+
+	// Bring a model space surface of this instance to world space
+	void toWorld(HitRecord &rec) const;
+};
+
+// ------------------------------------------------------------
+// Linear instance table compiled once from a SceneNode tree. Chains of
+// SceneNode/JointNode transforms are folded into a single affine matrix per
+// GeometryNode, and subtrees without any geometry are dropped. Every
+// primitive is prepared with the render's settings along the way.
+class CompiledScene {
+public:
+	CompiledScene(const SceneNode *root, const RenderSettings &settings);
+
+	// Closest intersection, only t and what was hit
+	RayHit intersect(const Ray &r, double t0, double t1) const;
+
+	// World space surface of a hit found by intersect, equivalent to
+	// SceneNode::hit
+	HitRecord surface(const Ray &r, const RayHit &hit) const;
+
+	// True if any instance blocks the ray in (t0, t1), and sets blocker to it
+	// if given
+	bool occluded(const Ray &r, double t0, double t1, uint32_t *blocker = nullptr) const;
+
+	// True if the given instance blocks the ray in (t0, t1), without
+	// traversing anything else (e.g. a blocker remembered from a nearby ray)
+	bool occludedBy(uint32_t instance, const Ray &r, double t0, double t1) const;
+
+	// Closest intersections of a packet of rays, hits[lane] is left untouched
+	// for lanes that miss
+	void intersectPacket(RayPacket &packet, RayHit *hits) const;
+
+	const std::vector<Instance> &instances() const;
+	size_t numInstances() const;
+	size_t numNodes() const;
+
+protected:
+	// Intersect the lanes of mask with the instances in [first, first + count),
+	// remembering the closest hit of each lane
+	void intersectInstances(uint32_t first, uint32_t count, const vmask &mask, RayPacket &packet, RayHit *hits) const;
+
+	std::vector<Instance> m_instances;
+
+private:
+	void compile(const SceneNode *node, const glm::mat4 &parentToWorld, const RenderSettings &settings);
+
+	size_t m_numNodes; // Scene graph nodes visited while compiling
+};
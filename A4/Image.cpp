@@ -1,17 +1,37 @@
 // Spring 2020
 
 #include "Image.hpp"
+#include "ThreadPool.hpp"
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <vector>
 #include <lodepng/lodepng.h>
 
 const uint Image::m_colorComponents = 3; // Red, blue, green
+const uint Image::TILE_SIZE;
+
+// Allocate the tiled storage of an image, cache line aligned
+static float * allocate(size_t numElements)
+{
+  if (numElements == 0)
+    return 0;
+
+  void * data = 0;
+  if (posix_memalign(&data, 64, numElements * sizeof(float)) != 0)
+    throw std::bad_alloc();
+
+  return static_cast<float *>(data);
+}
 
 //---------------------------------------------------------------------------------------
 Image::Image()
   : m_width(0),
     m_height(0),
+    m_tilesX(0),
     m_data(0)
 {
 }
@@ -22,44 +42,49 @@ Image::Image(
 		uint height
 )
   : m_width(width),
-    m_height(height)
+    m_height(height),
+    m_tilesX((width + TILE_SIZE - 1) / TILE_SIZE)
 {
-	size_t numElements = m_width * m_height * m_colorComponents;
-	m_data = new double[numElements];
-	memset(m_data, 0, numElements*sizeof(double));
+	m_data = allocate(numElements());
+	if (m_data)
+		memset(m_data, 0, numElements()*sizeof(float));
 }
 
 //---------------------------------------------------------------------------------------
 Image::Image(const Image & other)
   : m_width(other.m_width),
     m_height(other.m_height),
-    m_data(other.m_data ? new double[m_width * m_height * m_colorComponents] : 0)
+    m_tilesX(other.m_tilesX),
+    m_data(other.m_data ? allocate(other.numElements()) : 0)
 {
   if (m_data) {
-    std::memcpy(m_data, other.m_data,
-                m_width * m_height * m_colorComponents * sizeof(double));
+    std::memcpy(m_data, other.m_data, numElements() * sizeof(float));
   }
 }
 
 //---------------------------------------------------------------------------------------
 Image::~Image()
 {
-  delete [] m_data;
+  free(m_data);
 }
 
 //---------------------------------------------------------------------------------------
 Image & Image::operator=(const Image& other)
 {
-  delete [] m_data;
+  if (this == &other)
+    return *this;
+
+  free(m_data);
   
   m_width = other.m_width;
   m_height = other.m_height;
-  m_data = (other.m_data ? new double[m_width * m_height * m_colorComponents] : 0);
+  m_tilesX = other.m_tilesX;
+  m_data = (other.m_data ? allocate(other.numElements()) : 0);
 
   if (m_data) {
     std::memcpy(m_data,
                 other.m_data,
-                m_width * m_height * m_colorComponents * sizeof(double)
+                numElements() * sizeof(float)
     );
   }
   
@@ -79,15 +104,94 @@ uint Image::height() const
 }
 
 //---------------------------------------------------------------------------------------
-double Image::operator()(uint x, uint y, uint i) const
+size_t Image::index(uint x, uint y) const
+{
+  const size_t tile = size_t(y / TILE_SIZE) * m_tilesX + x / TILE_SIZE;
+  const size_t pixel = (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+
+  return (tile * TILE_SIZE * TILE_SIZE + pixel) * m_colorComponents;
+}
+
+//---------------------------------------------------------------------------------------
+size_t Image::numElements() const
+{
+  const size_t tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+  return size_t(m_tilesX) * tilesY * TILE_SIZE * TILE_SIZE * m_colorComponents;
+}
+
+//---------------------------------------------------------------------------------------
+float Image::operator()(uint x, uint y, uint i) const
+{
+  return m_data[index(x, y) + i];
+}
+
+//---------------------------------------------------------------------------------------
+float & Image::operator()(uint x, uint y, uint i)
+{
+  return m_data[index(x, y) + i];
+}
+
+//---------------------------------------------------------------------------------------
+void Image::setPixels(uint x0, uint y0, uint width, uint height, const float * rgb)
 {
-  return m_data[m_colorComponents * (m_width * y + x) + i];
+	for (uint y(y0); y < y0 + height; ++y) {
+		const float * row = rgb + size_t(y - y0) * width * m_colorComponents;
+
+		// Runs of pixels within one storage tile are contiguous
+		for (uint x(x0); x < x0 + width; ) {
+			const uint run = std::min(x0 + width, (x / TILE_SIZE + 1) * TILE_SIZE) - x;
+
+			std::memcpy(&m_data[index(x, y)], row + size_t(x - x0) * m_colorComponents,
+			            run * m_colorComponents * sizeof(float));
+			x += run;
+		}
+	}
 }
 
 //---------------------------------------------------------------------------------------
-double & Image::operator()(uint x, uint y, uint i)
+Image Image::heatmap(float * whitePoint) const
 {
-  return m_data[m_colorComponents * (m_width * y + x) + i];
+	// Colour ramp, evenly spaced from 0 to the white point
+	static const float ramp[][3] = {
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.3f, 0.0f, 0.5f },
+		{ 0.8f, 0.1f, 0.3f },
+		{ 1.0f, 0.6f, 0.0f },
+		{ 1.0f, 1.0f, 0.8f }
+	};
+	const uint numStops = sizeof(ramp) / sizeof(ramp[0]);
+
+	Image result(m_width, m_height);
+	if (m_width == 0 || m_height == 0)
+		return result;
+
+	// Scale by a high percentile, so a few outliers don't wash out the rest
+	std::vector<float> values;
+	values.reserve(size_t(m_width) * m_height);
+	for (uint y(0); y < m_height; y++) {
+		for (uint x(0); x < m_width; x++)
+			values.push_back((*this)(x, y, 0));
+	}
+
+	const size_t percentile = (values.size() - 1) * 99 / 100;
+	std::nth_element(values.begin(), values.begin() + percentile, values.end());
+	const float white = values[percentile] > 0.0f ? values[percentile] : 1.0f;
+
+	if (whitePoint)
+		*whitePoint = white;
+
+	for (uint y(0); y < m_height; y++) {
+		for (uint x(0); x < m_width; x++) {
+			const float t = std::min(std::max((*this)(x, y, 0) / white, 0.0f), 1.0f) * (numStops - 1);
+			const uint stop = std::min(uint(t), numStops - 2);
+			const float f = t - stop;
+
+			for (uint i(0); i < m_colorComponents; ++i)
+				result(x, y, i) = ramp[stop][i] + f * (ramp[stop + 1][i] - ramp[stop][i]);
+		}
+	}
+
+	return result;
 }
 
 //---------------------------------------------------------------------------------------
@@ -103,16 +207,31 @@ bool Image::savePng(const std::string & filename) const
 
 	image.resize(m_width * m_height * m_colorComponents);
 
-	double color;
-	for (uint y(0); y < m_height; y++) {
-		for (uint x(0); x < m_width; x++) {
-			for (uint i(0); i < m_colorComponents; ++i) {
-				color = m_data[m_colorComponents * (m_width * y + x) + i];
-				color = clamp(color, 0.0, 1.0);
-				image[m_colorComponents * (m_width * y + x) + i] = (unsigned char)(255 * color);
+	// Walk the storage tile by tile, cropping the padding. Rows of tiles
+	// are split between the threads the pool already has running.
+	const uint tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+	ThreadPool & pool = ThreadPool::shared();
+	const uint numWorkers = std::min(pool.numThreads() + 1, tilesY);
+
+	pool.run(numWorkers, [&](uint worker) {
+		for (uint ty(worker); ty < tilesY; ty += numWorkers) {
+			for (uint tx(0); tx < m_tilesX; tx++) {
+				const float * tile = &m_data[index(tx * TILE_SIZE, ty * TILE_SIZE)];
+
+				for (uint y(ty * TILE_SIZE); y < std::min(m_height, (ty + 1) * TILE_SIZE); y++) {
+					const float * row = tile + (y % TILE_SIZE) * TILE_SIZE * m_colorComponents;
+
+					for (uint x(tx * TILE_SIZE); x < std::min(m_width, (tx + 1) * TILE_SIZE); x++) {
+						for (uint i(0); i < m_colorComponents; ++i) {
+							double color = row[(x % TILE_SIZE) * m_colorComponents + i];
+							color = clamp(color, 0.0, 1.0);
+							image[m_colorComponents * (m_width * y + x) + i] = (unsigned char)(255 * color);
+						}
+					}
+				}
 			}
 		}
-	}
+	});
 
 	// Encode the image
 	unsigned error = lodepng::encode(filename, image, m_width, m_height, LCT_RGB);
@@ -126,13 +245,13 @@ bool Image::savePng(const std::string & filename) const
 }
 
 //---------------------------------------------------------------------------------------
-const double * Image::data() const
+const float * Image::data() const
 {
   return m_data;
 }
 
 //---------------------------------------------------------------------------------------
-double * Image::data()
+float * Image::data()
 {
   return m_data;
 }
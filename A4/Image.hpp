@@ -10,6 +10,10 @@ typedef unsigned int uint;
  * An image, consisting of a rectangle of floating-point elements.
  * Each pixel element consists of 3 components: Red, Blue, and Green.
  *
+ * Pixels are stored as floats in square tiles of TILE_SIZE x TILE_SIZE,
+ * each tile row major and starting on a cache line, so a worker filling
+ * a tile touches only its own lines.
+ *
  * This class makes it easy to save the image as a PNG file.
  * Note that colours in the range [0.0, 1.0] are mapped to the integer
  * range [0, 255] when writing PNG files.
@@ -37,22 +41,42 @@ public:
 	uint height() const;
 
     // Retrieve a particular component from the image.
-	double operator()(uint x, uint y, uint i) const;
+	float operator()(uint x, uint y, uint i) const;
 
 	// Retrieve a particular component from the image.
-	double & operator()(uint x, uint y, uint i);
+	float & operator()(uint x, uint y, uint i);
+
+	// Copy a width x height block of row major RGB pixels (e.g. a rendered
+	// tile) into the image at (x0, y0), one tile row at a time.
+	void setPixels(uint x0, uint y0, uint width, uint height, const float * rgb);
+
+	// False colour image of the first component (e.g. a per-pixel cost), from
+	// black through purple, red and yellow to white. Values are scaled so the
+	// 99th percentile maps to white, which is returned in whitePoint if given.
+	Image heatmap(float * whitePoint = 0) const;
 
 	// Save this image into the PNG file with name 'filename'.
 	// Warning: If 'filename' already exists, it will be overwritten.
 	bool savePng(const std::string & filename) const;
 
-	const double * data() const;
-	double * data();
+	// Tiled storage, see index()
+	const float * data() const;
+	float * data();
+
+	// Width and height of a storage tile, in pixels
+	static const uint TILE_SIZE = 8;
 
 private:
+	// Offset of pixel (x, y) in m_data
+	size_t index(uint x, uint y) const;
+
+	// Elements of the padded storage, whole tiles in both directions
+	size_t numElements() const;
+
 	uint m_width;
 	uint m_height;
-	double * m_data;
+	uint m_tilesX; // Tiles per row of tiles
+	float * m_data;
 
 	static const uint m_colorComponents;
 };
@@ -0,0 +1,89 @@
+// Spring 2020
+
+#include "LightBVH.hpp"
+#include "Epsilon.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+LightBVH::LightBVH(const list<Light *> &lights, double cutoff)
+	: m_unbounded(), m_bounded(), m_bvh(), m_numLights(lights.size())
+{
+	vector<BoundedLight> bounded;
+	vector<AABB> bounds;
+
+	uint32_t index = 0;
+	for(const Light *light : lights){
+		const float radius = influenceRadius(*light, cutoff);
+
+		if(radius == INF_FLOAT){
+			m_unbounded.push_back({ light, index });
+		} else if(radius > 0.0f){
+			bounded.push_back({ light->position, radius * radius, { light, index } });
+			bounds.emplace_back(light->position - vec3(radius), light->position + vec3(radius));
+		}
+
+		++index;
+	}
+
+	if(bounded.empty())
+		return;
+
+	// Store the lights in leaf order so leaves index them directly
+	m_bvh.build(bounds);
+
+	m_bounded.reserve(bounded.size());
+	for(const uint32_t index : m_bvh.indices())
+		m_bounded.push_back(bounded[index]);
+}
+
+float LightBVH::influenceRadius(const Light &light, double cutoff)
+{
+	// Negative coefficients don't make for a falloff, never cull those lights
+	const double c0 = light.falloff[0];
+	const double c1 = light.falloff[1];
+	const double c2 = light.falloff[2];
+
+	if(cutoff <= 0.0 || c0 < 0.0 || c1 < 0.0 || c2 < 0.0)
+		return INF_FLOAT;
+
+	const double intensity = std::max(light.colour.r, std::max(light.colour.g, light.colour.b));
+	if(intensity <= 0.0)
+		return 0.0f;
+
+	// Solve intensity / (c0 + c1 d + c2 d^2) = cutoff for d
+	const double k = intensity / cutoff - c0;
+	if(k <= 0.0)
+		return 0.0f;
+
+	if(c2 > 0.0)
+		return float((-c1 + std::sqrt(c1 * c1 + 4.0 * c2 * k)) / (2.0 * c2));
+
+	if(c1 > 0.0)
+		return float(k / c1);
+
+	return INF_FLOAT;
+}
+
+size_t LightBVH::numLights() const
+{
+	return m_numLights;
+}
+
+size_t LightBVH::numBounded() const
+{
+	return m_bounded.size();
+}
+
+size_t LightBVH::numUnbounded() const
+{
+	return m_unbounded.size();
+}
+
+size_t LightBVH::numDark() const
+{
+	return m_numLights - m_bounded.size() - m_unbounded.size();
+}
@@ -0,0 +1,71 @@
+// Spring 2020
+
+#pragma once
+
+#include "Light.hpp"
+#include "BVH.hpp"
+
+#include <list>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// ------------------------------------------------------------
+// Lights of a scene, culled by distance. Each light's falloff gives the
+// distance beyond which its brightest channel drops below a cutoff
+// intensity, and lights with a finite radius go in a BVH over their spheres
+// of influence so shading only visits the ones that can reach a point.
+class LightBVH {
+public:
+	// Copies the light pointers, the lights themselves must outlive this
+	LightBVH(const std::list<Light *> &lights, double cutoff);
+
+	// Call fn(const Light *, uint32_t index) for every light that can reach p
+	// by more than the cutoff, index being its position in the scene's list.
+	// Lights that never fade out come first, in scene order.
+	template<typename Fn>
+	void forEach(const glm::vec3 &p, Fn &&fn) const;
+
+	// Distance at which light's brightest channel falls to cutoff, infinite if
+	// it never does (no falloff, or a cutoff of 0), 0 if it starts below it
+	static float influenceRadius(const Light &light, double cutoff);
+
+	size_t numLights() const;
+	size_t numBounded() const;   // In the hierarchy
+	size_t numUnbounded() const; // Shaded everywhere
+	size_t numDark() const;      // Never above the cutoff, dropped
+
+private:
+	struct IndexedLight {
+		const Light *light;
+		uint32_t index;
+	};
+
+	struct BoundedLight {
+		glm::vec3 position;
+		float radius2; // Squared influence radius
+		IndexedLight light;
+	};
+
+	std::vector<IndexedLight> m_unbounded;
+	std::vector<BoundedLight> m_bounded; // In leaf order of m_bvh
+	BVH m_bvh;
+	size_t m_numLights;
+};
+
+template<typename Fn>
+void LightBVH::forEach(const glm::vec3 &p, Fn &&fn) const
+{
+	for(const IndexedLight &unbounded : m_unbounded)
+		fn(unbounded.light, unbounded.index);
+
+	m_bvh.query(p, [&](uint32_t first, uint32_t count) {
+		for(uint32_t i = first; i < first + count; ++i){
+			const BoundedLight &bounded = m_bounded[i];
+			const glm::vec3 offset = bounded.position - p;
+
+			if(glm::dot(offset, offset) <= bounded.radius2)
+				fn(bounded.light.light, bounded.light.index);
+		}
+	});
+}
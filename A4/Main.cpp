@@ -1,16 +1,72 @@
 // Speing 2020
 
 #include <iostream>
+#include <string>
 #include "scene_lua.hpp"
+#include "RenderSettings.hpp"
+
+static void printUsage(const char* program)
+{
+  std::cerr << "Usage: " << program << " [options] [scene.lua]\n"
+            << "\n"
+            << "Options (see RenderSettings.hpp):\n"
+            << "  --progress=<bool>                 --no-progress\n"
+            << "  --stats-json=<file|->             --output=<file.png>\n"
+            << "  --multithreading=<bool>           --threads=<n> (0 = all cores)\n"
+            << "  --tile-size=<n>                   --packets=<bool>\n"
+            << "  --bounding-volumes=<bool>         --bounding-volume=<box|sphere>\n"
+            << "  --render-bounding-volumes=<bool>  --lazy-meshes=<bool>\n"
+            << "  --mesh-bvh=<bool>                 --scene-bvh=<bool>\n"
+            << "  --wide-bvh=<bool>                 --mesh-cache=<bool>\n"
+            << "  --supersampling=<bool|factor>     --reflections=<bool|bounces>\n"
+            << "  --adaptive=<bool>                 --adaptive-threshold=<amount>\n"
+            << "  --reflection-mix=<amount>         --light-cutoff=<amount>\n"
+            << "  --shadow-cache=<bool>             --heatmap=<off|time|steps>\n"
+            << "  --wavefront=<bool>                --tile-order=<rows|morton|hilbert>\n"
+            << "  --cache-counters=<bool>           --pin-threads=<bool>\n"
+            << "\n"
+            << "Boolean options can also be written as --name or --no-name.\n";
+}
 
 int main(int argc, char** argv)
 {
   std::string filename = "Assets/simple.lua";
-  if (argc >= 2) {
-    filename = argv[1];
+  RenderSettings settings;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+
+    if (arg == "-h" || arg == "--help") {
+      printUsage(argv[0]);
+      return 0;
+    }
+
+    if (arg.compare(0, 2, "--") != 0) {
+      filename = arg;
+      continue;
+    }
+
+    // --name=value, --name or --no-name
+    std::string name = arg.substr(2);
+    std::string value = "true";
+
+    const size_t equals = name.find('=');
+    if (equals != std::string::npos) {
+      value = name.substr(equals + 1);
+      name = name.substr(0, equals);
+    } else if (name.compare(0, 3, "no-") == 0) {
+      name = name.substr(3);
+      value = "false";
+    }
+
+    if (!settings.set(name, value)) {
+      std::cerr << "Invalid option " << arg << std::endl;
+      printUsage(argv[0]);
+      return 1;
+    }
   }
 
-  if (!run_lua(filename)) {
+  if (!run_lua(filename, settings)) {
     std::cerr << "Could not open " << filename << std::endl;
     return 1;
   }
@@ -0,0 +1,111 @@
+// Spring 2020
+
+#include "MappedFile.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile()
+	: m_data(nullptr), m_size(0), m_mapped(false)
+{}
+
+MappedFile::MappedFile(const string &path)
+	: MappedFile()
+{
+	open(path);
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const string &path)
+{
+	close();
+
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)){
+		::close(fd);
+		return false;
+	}
+
+	m_size = size_t(info.st_size);
+
+	// mmap can't map nothing, an empty file is still a valid one
+	if(m_size == 0){
+		::close(fd);
+		m_data = reinterpret_cast<const uint8_t *>("");
+		return true;
+	}
+
+	void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if(p == MAP_FAILED){
+		m_size = 0;
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t *>(p);
+	m_mapped = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(m_mapped)
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+
+	m_data = nullptr;
+	m_size = 0;
+	m_mapped = false;
+}
+
+bool MappedFile::isOpen() const
+{
+	return m_data != nullptr;
+}
+
+const uint8_t *MappedFile::data() const
+{
+	return m_data;
+}
+
+size_t MappedFile::size() const
+{
+	return m_size;
+}
+
+
+// ------------------------------------------------------------
+// Multiply-xorshift over 8 byte words, then the tail byte by byte
+uint64_t hashBytes(const uint8_t *data, size_t size)
+{
+	const uint64_t PRIME = 0x100000001b3ull;
+	uint64_t h = 0xcbf29ce484222325ull ^ size;
+
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8){
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = (h ^ word) * PRIME;
+		h ^= h >> 29;
+	}
+
+	for(; i < size; ++i)
+		h = (h ^ data[i]) * PRIME;
+
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,36 @@
+// Spring 2020
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// ------------------------------------------------------------
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+	MappedFile();
+	explicit MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Map path, dropping any previous mapping. Returns false if the file
+	// can't be opened or mapped.
+	bool open(const std::string &path);
+	void close();
+
+	bool isOpen() const;
+	const uint8_t *data() const;
+	size_t size() const;
+
+private:
+	const uint8_t *m_data;
+	size_t m_size;
+	bool m_mapped; // Empty files are open but not mapped
+};
+
+// 64 bit hash of a block of memory, used to key caches by file contents
+uint64_t hashBytes(const uint8_t *data, size_t size);
@@ -5,128 +5,368 @@
 #include "Epsilon.hpp"
 #include "Ray.hpp"
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+#include "ObjParser.hpp"
 
 #include <iostream>
-#include <fstream>
+#include <chrono>
+#include <sstream>
 #include <memory>
+#include <algorithm>
+#include <limits>
 
 #include <glm/ext.hpp>
 
 using namespace std;
 using namespace glm;
 
-// Fundamentals of Computer Graphics 4.4.2
-HitRecord Triangle::hit(const Ray &r, double t0, double t1, const vec3 *verts) const
+// ------------------------------------------------------------
+// TriangleBlock
+TriangleBlock::TriangleBlock()
 {
-	HitRecord rec;
+	const float nan = std::numeric_limits<float>::quiet_NaN();
 
-	// Vertices
-	const auto &v1 = verts[0];
-	const auto &v2 = verts[1];
-	const auto &v3 = verts[2];
+	for(int axis = 0; axis < 3; ++axis){
+		std::fill(v0[axis], v0[axis] + SIMD_WIDTH, nan);
+		std::fill(e1[axis], e1[axis] + SIMD_WIDTH, nan);
+		std::fill(e2[axis], e2[axis] + SIMD_WIDTH, nan);
+	}
+}
 
-	// Column 3 of A, [g, h, i]^T
-	const auto direction = r.direction;
-	const double g = direction.x;
-	const double h = direction.y;
-	const double i = direction.z;
+void TriangleBlock::set(uint lane, const vec3 &a, const vec3 &b, const vec3 &c)
+{
+	for(int axis = 0; axis < 3; ++axis){
+		v0[axis][lane] = a[axis];
+		e1[axis][lane] = b[axis] - a[axis];
+		e2[axis][lane] = c[axis] - a[axis];
+	}
+}
 
-	// Column 1
-	const double a = v1.x - v2.x;
-	const double b = v1.y - v2.y;
-	const double c = v1.z - v2.z;
+// Möller-Trumbore, Fast, Minimum Storage Ray/Triangle Intersection (1997).
+// u and v are the barycentric coordinates of the second and third vertex,
+// NaNs (padding lanes, degenerate triangles) fail every comparison.
+static vmask mollerTrumbore(
+	const vfloat &ox, const vfloat &oy, const vfloat &oz,
+	const vfloat &dx, const vfloat &dy, const vfloat &dz,
+	const vfloat &v0x, const vfloat &v0y, const vfloat &v0z,
+	const vfloat &e1x, const vfloat &e1y, const vfloat &e1z,
+	const vfloat &e2x, const vfloat &e2y, const vfloat &e2z,
+	const vfloat &t0, const vfloat &t1,
+	vfloat &t
+)
+{
+	// p = d x e2
+	const vfloat px = dy * e2z - dz * e2y;
+	const vfloat py = dz * e2x - dx * e2z;
+	const vfloat pz = dx * e2y - dy * e2x;
 
-	// Column 2
-	const double d = v1.x - v3.x;
-	const double e = v1.y - v3.y;
-	const double f = v1.z - v3.z;
+	const vfloat invDet = vfloat(1.0f) / (e1x * px + e1y * py + e1z * pz);
 
-	// Right hand side
-	const double j = v1.x - r.origin.x;
-	const double k = v1.y - r.origin.y;
-	const double l = v1.z - r.origin.z;
+	// s = o - v0
+	const vfloat sx = ox - v0x;
+	const vfloat sy = oy - v0y;
+	const vfloat sz = oz - v0z;
 
-	// Cache reused computations
-	const double ei_minus_hf = (e * i) - (h * f);
-	const double gf_minus_di = (g * f) - (d * i);
-	const double dh_minus_eg = (d * h) - (e * g);
-	const double ak_minus_jb = (a * k) - (j * b);
-	const double jc_minus_al = (j * c) - (a * l);
-	const double bl_minus_kc = (b * l) - (k * c);
+	const vfloat u = (sx * px + sy * py + sz * pz) * invDet;
 
-	// Compute M, invert it here and then multiply moving forward
-	const double M = 1.0 / ((a * ei_minus_hf) + (b * gf_minus_di) + (c * dh_minus_eg));
+	// q = s x e1
+	const vfloat qx = sy * e1z - sz * e1y;
+	const vfloat qy = sz * e1x - sx * e1z;
+	const vfloat qz = sx * e1y - sy * e1x;
 
-	// Compute t and verify that it is in bounds
-	double t = - ((f * ak_minus_jb) + (e * jc_minus_al) + (d * bl_minus_kc)) * M;
-	if(t <= t0 || t >= t1 || t >= rec.t)
-		return rec;
+	const vfloat v = (dx * qx + dy * qy + dz * qz) * invDet;
+	t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
 
-	// Compute gamma and verify that it is in bounds
-	double gamma = ((i * ak_minus_jb) + (h * jc_minus_al) + (g * bl_minus_kc)) * M;
-	if(gamma < EPSILON || gamma > 1.0)
-		return rec;
+	const vfloat eps = vfloat(float(EPSILON));
 
-	// Compute Beta and verify that it is in bounds
-	double beta = ((j * ei_minus_hf) + (k * gf_minus_di) + (l * dh_minus_eg)) * M;
-	if(beta < EPSILON || beta > 1.0 - gamma)
-		return rec;
+	return (t > t0) & (t < t1)
+		& (v >= eps) & (v <= vfloat(1.0f))
+		& (u >= eps) & (u <= vfloat(1.0f) - v);
+}
 
-	// Intersected triangle at a closer point, update rec
-	rec.hit = true;
-	rec.t = t;
-	rec.n = vec4(glm::cross(v2 - v1, v3 - v1), 0);
+vmask TriangleBlock::intersect(const vec3 &origin, const vec3 &direction, float t0, float t1, vfloat &t) const
+{
+	return mollerTrumbore(
+		vfloat(origin.x), vfloat(origin.y), vfloat(origin.z),
+		vfloat(direction.x), vfloat(direction.y), vfloat(direction.z),
+		vfloat::load(v0[0]), vfloat::load(v0[1]), vfloat::load(v0[2]),
+		vfloat::load(e1[0]), vfloat::load(e1[1]), vfloat::load(e1[2]),
+		vfloat::load(e2[0]), vfloat::load(e2[1]), vfloat::load(e2[2]),
+		vfloat(t0), vfloat(t1),
+		t
+	);
+}
 
-	return rec;
+vmask TriangleBlock::intersect(uint lane, const RayPacket &packet, const vmask &mask, vfloat &t) const
+{
+	return mask & mollerTrumbore(
+		packet.ox, packet.oy, packet.oz,
+		packet.dx, packet.dy, packet.dz,
+		vfloat(v0[0][lane]), vfloat(v0[1][lane]), vfloat(v0[2][lane]),
+		vfloat(e1[0][lane]), vfloat(e1[1][lane]), vfloat(e1[2][lane]),
+		vfloat(e2[0][lane]), vfloat(e2[1][lane]), vfloat(e2[2][lane]),
+		packet.tMin, packet.tMax,
+		t
+	);
 }
 
 
 // ------------------------------------------------------------
 // Mesh
-Mesh::Mesh(const string &fname)
+
+// End of the blocks holding the leaf slots [first, first + count), leaves
+// always start on a block boundary
+static uint32_t blocksEnd(uint32_t first, uint32_t count)
+{
+	return (first + count + SIMD_WIDTH - 1) / SIMD_WIDTH;
+}
+
+// Lazy loads finished during rendering, over every mesh
+static atomic<uint64_t> lazyLoads(0);
+static atomic<uint64_t> lazyLoadNs(0);
+
+// Printed after the render rather than in the middle of its progress
+static mutex lazyLogMutex;
+static string lazyLog;
+
+Mesh::Mesh(const string &fname, const RenderSettings &settings)
 	: m_vertices(), 
-	  m_faces()
-#ifdef ENABLE_BOUNDING_VOLUMES
-	  ,m_boundingMin(INF_FLOAT), 
-	  m_boundingMax(-INF_FLOAT)
-#endif
-{
-	string code;
-	double vx, vy, vz;
-	size_t s1, s2, s3;
-
-	ifstream ifs(fname.c_str());
-
-	while( ifs >> code ) {
-		if(code == "v") {
-			ifs >> vx >> vy >> vz;
-			m_vertices.emplace_back(vx, vy, vz);
-
-#ifdef ENABLE_BOUNDING_VOLUMES
-			// Find min and max points
-			if(vx < m_boundingMin.x) m_boundingMin.x = vx;
-			if(vx > m_boundingMax.x) m_boundingMax.x = vx;
-
-			if(vy < m_boundingMin.y) m_boundingMin.y = vy;
-			if(vy > m_boundingMax.y) m_boundingMax.y = vy;
-
-			if(vz < m_boundingMin.z) m_boundingMin.z = vz;
-			if(vz > m_boundingMax.z) m_boundingMax.z = vz;
-#endif
-
-		} else if(code == "f") {
-			ifs >> s1 >> s2 >> s3;
-			m_faces.emplace_back(s1 - 1, s2 - 1, s3 - 1);
-		}
+	  m_faces(),
+	  m_boundingMin(INF_FLOAT), 
+	  m_boundingMax(-INF_FLOAT),
+	  m_useBoundingVolume(DEFAULT_BOUNDING_VOLUMES),
+	  m_renderBoundingVolume(DEFAULT_RENDER_BOUNDING_VOLUMES),
+	  m_boundingVolumeType(DEFAULT_BOUNDING_VOLUME),
+	  m_useBVH(DEFAULT_MESH_BVH),
+	  m_useWideBVH(DEFAULT_WIDE_BVH),
+	  m_fname(fname),
+	  m_loadSettings(settings),
+	  m_lazy(settings.lazyMeshes),
+	  m_lazyBounds(),
+	  m_loaded(false)
+{
+	// Load in the background while the rest of the scene is set up
+	if(settings.multithreading){
+		// At least one pool thread, or the load wouldn't start until wait()
+		ThreadPool &pool = ThreadPool::shared();
+		pool.reserve(std::max(1u, settings.numWorkers() - 1));
+		m_loading = pool.submit([this]() { load(); });
+	} else {
+		load();
+		wait();
+	}
+}
+
+Mesh::~Mesh()
+{
+	// The pool outlives the mesh, don't leave it loading into freed memory
+	try {
+		if(m_loading.valid())
+			m_loading.wait();
+	} catch(...) {
+	}
+}
+
+void Mesh::wait()
+{
+	if(m_loading.valid())
+		m_loading.wait();
+
+	cout << m_loadLog;
+	m_loadLog.clear();
+}
+
+void Mesh::load()
+{
+	// Printed by wait(), so loads running side by side don't interleave
+	ostringstream log;
+
+	if(m_lazy){
+		loadBounds(log);
+		m_lazyBounds = AABB(m_boundingMin, m_boundingMax);
+	} else {
+		loadData(log);
 	}
 
-#ifdef ENABLE_BOUNDING_VOLUMES
 	// Generate bounding volume
-	m_bv = unique_ptr<Primitive>(boundingVolume(BOUNDING_VOLUME));
-#endif
+	m_bv = unique_ptr<Primitive>(boundingVolume(m_boundingVolumeType));
+
+	m_loadLog = log.str();
+}
+
+// Time since t, in milliseconds
+static double msSince(chrono::steady_clock::time_point t)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+void Mesh::loadBounds(ostream &log)
+{
+	const auto start = chrono::steady_clock::now();
+
+	// From the cache's header if there is one, otherwise just the vertices
+	MappedFile obj(m_fname);
+	const bool useCache = m_loadSettings.meshCache && obj.isOpen();
+	const uint64_t contentHash = useCache ? hashBytes(obj.data(), obj.size()) : 0;
+
+	if(!useCache || !MeshCache::loadBounds(MeshCache::pathFor(m_fname), contentHash, m_boundingMin, m_boundingMax)){
+		const ObjData data = parseObj(reinterpret_cast<const char *>(obj.data()), obj.size(), m_loadSettings.numWorkers(), true);
+		m_boundingMin = data.min;
+		m_boundingMax = data.max;
+	}
+
+	log << "Found bounds of " << m_fname << " in " << msSince(start) << "ms, loading it on first hit" << endl;
+}
+
+void Mesh::loadData(ostream &log)
+{
+	const auto start = chrono::steady_clock::now();
+
+	// A missing file is an empty mesh
+	MappedFile obj(m_fname);
+
+	// The cache is keyed by the OBJ's contents, not its timestamp
+	const bool useCache = m_loadSettings.meshCache && obj.isOpen();
+	const string cachePath = MeshCache::pathFor(m_fname);
+	const uint64_t contentHash = useCache ? hashBytes(obj.data(), obj.size()) : 0;
+
+	if(useCache && MeshCache::load(cachePath, contentHash, *this)){
+		log << "Loaded " << m_fname << " from " << cachePath << " in " << msSince(start) << "ms" << endl;
+	} else {
+		ObjData data = parseObj(reinterpret_cast<const char *>(obj.data()), obj.size(), m_loadSettings.numWorkers());
+		m_vertices = std::move(data.vertices);
+		m_faces = std::move(data.faces);
+		m_boundingMin = data.min;
+		m_boundingMax = data.max;
+
+		log << "Loaded " << m_fname << " (" << m_vertices.size() << " vertices, " << m_faces.size()
+			<< " faces) in " << msSince(start) << "ms";
+		if(data.skippedLines > 0)
+			log << ", skipped " << data.skippedLines << " malformed lines";
+		log << endl;
+
+		const auto buildStart = chrono::steady_clock::now();
+		buildBVH(m_loadSettings.numWorkers());
+		log << "\tbuilt hierarchies in " << msSince(buildStart) << "ms" << endl;
+
+		if(useCache && MeshCache::save(cachePath, contentHash, *this))
+			log << "\tcached in " << cachePath << endl;
+	}
+
+	m_loaded.store(true, std::memory_order_release);
+}
+
+bool Mesh::ensureLoaded(const Ray &r, double t0, double t1) const
+{
+	if(m_loaded.load(std::memory_order_acquire))
+		return true;
+
+	if(!m_lazyBounds.hit(vec3(r.origin), 1.0f / vec3(r.direction), t0, t1))
+		return false;
+
+	finishLazyLoad();
+	return true;
+}
+
+bool Mesh::ensureLoaded(const RayPacket &packet) const
+{
+	if(m_loaded.load(std::memory_order_acquire))
+		return true;
+
+	if((m_lazyBounds.hit(packet) & packet.active).none())
+		return false;
+
+	finishLazyLoad();
+	return true;
+}
+
+void Mesh::finishLazyLoad() const
+{
+	// Other workers hitting the mesh meanwhile wait here for the first one.
+	// Loading sets the same bounds as loadBounds(), and m_bv keeps its own.
+	std::call_once(m_lazyOnce, [this]() {
+		const auto start = chrono::steady_clock::now();
+
+		ostringstream log;
+		const_cast<Mesh *>(this)->loadData(log);
+
+		lazyLoads += 1;
+		lazyLoadNs += uint64_t(msSince(start) * 1e6);
+
+		lock_guard<mutex> lock(lazyLogMutex);
+		lazyLog += log.str();
+	});
+}
+
+Mesh::LazyLoadStats Mesh::lazyLoadStats()
+{
+	return { lazyLoads.load(), lazyLoadNs.load() * 1e-6 };
+}
+
+string Mesh::takeLazyLoadLog()
+{
+	lock_guard<mutex> lock(lazyLogMutex);
+
+	string log;
+	log.swap(lazyLog);
+	return log;
+}
+
+void Mesh::prepare(const RenderSettings &settings)
+{
+	wait();
+
+	m_useBoundingVolume = settings.boundingVolumes;
+	m_renderBoundingVolume = settings.boundingVolumes && settings.renderBoundingVolumes;
+	m_useBVH = settings.meshBVH;
+	m_useWideBVH = settings.wideBVH;
+
+	// Regenerate the bounding volume if its type changed
+	if(settings.boundingVolume != m_boundingVolumeType){
+		m_boundingVolumeType = settings.boundingVolume;
+		m_bv = unique_ptr<Primitive>(boundingVolume(m_boundingVolumeType));
+	}
+}
+
+void Mesh::buildBVH(uint numThreads)
+{
+	m_triangles.clear();
+	m_normals.clear();
+
+	vector<AABB> faceBounds;
+	faceBounds.reserve(m_faces.size());
+
+	for(const auto &triangle : m_faces){
+		AABB bounds;
+		bounds.expand(m_vertices[triangle.v1]);
+		bounds.expand(m_vertices[triangle.v2]);
+		bounds.expand(m_vertices[triangle.v3]);
+		faceBounds.push_back(bounds);
+	}
+
+	m_bvh.build(faceBounds, SIMD_WIDTH, numThreads);
+	m_wideBVH.build(m_bvh);
+
+	// Precompute the faces in leaf order, leaves are padded to whole blocks
+	const auto &indices = m_bvh.indices();
+	m_triangles.resize(indices.size() / SIMD_WIDTH);
+	m_normals.resize(indices.size(), vec3(0.0f));
+
+	for(size_t slot = 0; slot < indices.size(); ++slot){
+		if(indices[slot] == BVH::INVALID_INDEX)
+			continue;
+
+		const auto &triangle = m_faces[indices[slot]];
+		const vec3 &a = m_vertices[triangle.v1];
+		const vec3 &b = m_vertices[triangle.v2];
+		const vec3 &c = m_vertices[triangle.v3];
+
+		m_triangles[slot / SIMD_WIDTH].set(slot % SIMD_WIDTH, a, b, c);
+		m_normals[slot] = glm::cross(b - a, c - a);
+	}
 }
 
-#ifdef ENABLE_BOUNDING_VOLUMES
 Primitive *Mesh::boundingVolume(BoundingVolume volType) const
 {
 	Primitive *volume;
@@ -149,50 +389,167 @@ Primitive *Mesh::boundingVolume(BoundingVolume volType) const
 	
 	return volume;
 }
-#endif
 
-HitRecord Mesh::hit(const Ray &r, double t0, double t1) const
+bool Mesh::intersect(const Ray &r, double t0, double &t1, uint32_t &id) const
 {
-	HitRecord rec;
-
-#ifdef ENABLE_BOUNDING_VOLUMES
 	// Check intersection with bounding volume (and possibly render it)
-	#ifdef RENDER_BOUNDING_VOLUMES
-		return m_bv->hit(r, t0, t1);
-	#else
-		if(!m_bv->hit(r, t0, t1))
-			return rec;
-	#endif
-#endif
-	const auto &direction = r.direction;
-
-	// Column 3 of A, [g, h, i]^T
-	const double g = direction.x;
-	const double h = direction.y;
-	const double i = direction.z;
-
-	for(const auto triangle : m_faces){		
-		const vec3 triangleVerts[3] = {
-			m_vertices[triangle.v1],
-			m_vertices[triangle.v2],
-			m_vertices[triangle.v3]
-		};
-
-		// Check if triangle is hit
-		HitRecord record = triangle.hit(r, t0, t1, triangleVerts);
-		if(record.hit){
-			t1 = record.t;
-			rec = record;
+	if(m_useBoundingVolume){
+		if(m_renderBoundingVolume)
+			return m_bv->intersect(r, t0, t1, id);
+
+		double tVolume = t1;
+		uint32_t volumeId;
+		if(!m_bv->intersect(r, t0, tVolume, volumeId))
+			return false;
+	}
+
+	if(!ensureLoaded(r, t0, t1))
+		return false;
+
+	const vec3 origin(r.origin);
+	const vec3 direction(r.direction);
+
+	// Closest face, by block * SIMD_WIDTH + lane
+	size_t closest = m_normals.size();
+
+	// Intersect the blocks of [first, first + count), keeping the closest hit
+	auto hitFaces = [&](uint32_t first, uint32_t count, double &tMax) {
+		bool hit = false;
+
+		for(uint32_t block = first / SIMD_WIDTH; block < blocksEnd(first, count); ++block){
+			vfloat t;
+			const vmask hits = m_triangles[block].intersect(origin, direction, float(t0), float(tMax), t);
+			traversalCounters.triangleTests += SIMD_WIDTH;
+
+			forEachLane(hits, [&](uint lane) {
+				if(t[lane] < tMax){
+					tMax = t[lane];
+					closest = block * SIMD_WIDTH + lane;
+					hit = true;
+				}
+			});
 		}
+
+		return hit;
+	};
+
+	if(m_useBVH && m_useWideBVH)
+		m_wideBVH.hit(r, t0, t1, hitFaces);
+	else if(m_useBVH)
+		m_bvh.hit(r, t0, t1, hitFaces);
+	else
+		hitFaces(0, m_normals.size(), t1);
+
+	if(closest == m_normals.size())
+		return false;
+
+	id = uint32_t(closest);
+	return true;
+}
+
+void Mesh::surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const
+{
+	if(m_renderBoundingVolume)
+		return m_bv->surface(r, t, id, rec);
+
+	rec.n = vec4(m_normals[id], 0);
+	rec.point = r.pointAt(t);
+}
+
+bool Mesh::occluded(const Ray &r, double t0, double t1) const
+{
+	if(m_useBoundingVolume){
+		if(m_renderBoundingVolume)
+			return m_bv->occluded(r, t0, t1);
+
+		// The segment may end inside the volume, so only cull rays that miss it entirely
+		double tVolume = INF_DOUBLE;
+		uint32_t volumeId;
+		if(!m_bv->intersect(r, t0, tVolume, volumeId))
+			return false;
 	}
 
-	if(rec.hit)
-		rec.point = r.pointAt(rec.t);
+	if(!ensureLoaded(r, t0, t1))
+		return false;
+
+	const vec3 origin(r.origin);
+	const vec3 direction(r.direction);
+
+	// Stop at the first block of [first, first + count) that blocks the ray
+	auto occludedByFaces = [&](uint32_t first, uint32_t count) {
+		for(uint32_t block = first / SIMD_WIDTH; block < blocksEnd(first, count); ++block){
+			vfloat t;
+			traversalCounters.triangleTests += SIMD_WIDTH;
+			if(m_triangles[block].intersect(origin, direction, float(t0), float(t1), t).any())
+				return true;
+		}
+
+		return false;
+	};
 
-	return rec;
+	if(m_useBVH && m_useWideBVH)
+		return m_wideBVH.occluded(r, t0, t1, occludedByFaces);
+	if(m_useBVH)
+		return m_bvh.occluded(r, t0, t1, occludedByFaces);
+
+	return occludedByFaces(0, m_normals.size());
+}
+
+vmask Mesh::intersectPacket(RayPacket &packet, uint32_t *ids) const
+{
+	// Rendered bounding volumes and sphere culling take the single ray path,
+	// the BVH's root box culls the packet otherwise
+	if(m_renderBoundingVolume || (m_useBoundingVolume && m_boundingVolumeType != BoundingVolume::BoundingBox))
+		return Primitive::intersectPacket(packet, ids);
+
+	vmask hitLanes = vmask::fromBits(0);
+	if(!ensureLoaded(packet))
+		return hitLanes;
+
+	// Test each face of [first, first + count) against the whole packet
+	auto hitFaces = [&](uint32_t first, uint32_t count, const vmask &mask) {
+		for(uint32_t slot = first; slot < first + count; ++slot){
+			vfloat t;
+			const vmask hit = m_triangles[slot / SIMD_WIDTH].intersect(slot % SIMD_WIDTH, packet, mask, t);
+			traversalCounters.triangleTests += __builtin_popcount(mask.bits());
+			if(hit.none())
+				continue;
+
+			packet.tMax = select(hit, t, packet.tMax);
+			hitLanes = hitLanes | hit;
+			forEachLane(hit, [&](uint lane) { ids[lane] = slot; });
+		}
+	};
+
+	if(m_useBVH && m_useWideBVH)
+		m_wideBVH.hitPacket(packet, hitFaces);
+	else if(m_useBVH)
+		m_bvh.hitPacket(packet, hitFaces);
+	else if(!m_bvh.empty() && m_bvh.bounds().hit(packet).any()) // No faces, no nodes
+		hitFaces(0, m_normals.size(), packet.active);
+
+	return hitLanes;
+}
+
+AABB Mesh::bounds() const
+{
+	if(m_renderBoundingVolume)
+		return m_bv->bounds();
+
+	return AABB(m_boundingMin, m_boundingMax);
+}
+
+const BVH &Mesh::bvh() const
+{
+	return m_bvh;
+}
+
+const WideBVH &Mesh::wideBVH() const
+{
+	return m_wideBVH;
 }
 
-std::ostream& operator<<(ostream& out, const Mesh& mesh)
+std::ostream& operator<<(ostream& out, const Mesh&)
 {
   out << "mesh {";
 //   /*
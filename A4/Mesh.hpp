@@ -4,11 +4,16 @@
 
 #include "Options.hpp"
 #include "Primitive.hpp"
+#include "BVH.hpp"
+#include "WideBVH.hpp"
+#include "ThreadPool.hpp"
 
 #include <vector>
 #include <iosfwd>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <atomic>
 
 #include <glm/glm.hpp>
 
@@ -23,28 +28,120 @@ struct Triangle
 		  v2(pv2),
 		  v3(pv3)
 	{}
+};
+
+// SIMD_WIDTH triangles in structure of arrays form, with everything the
+// Möller-Trumbore test needs precomputed. Unused lanes are NaN and never hit.
+struct TriangleBlock {
+	float v0[3][SIMD_WIDTH]; // First vertex
+	float e1[3][SIMD_WIDTH]; // Second vertex - first vertex
+	float e2[3][SIMD_WIDTH]; // Third vertex - first vertex
+
+	TriangleBlock();
+
+	// Store triangle (a, b, c) in a lane
+	void set(uint lane, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+
+	// Every triangle against one ray, returns the triangles hit within
+	// (t0, t1) and sets t for them
+	vmask intersect(const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, vfloat &t) const;
 
-	HitRecord hit(const Ray &r, double t0, double t1, const glm::vec3 *verts) const;
+	// The triangle in lane against the rays of mask, returns the rays hitting
+	// it within (tMin, tMax) and sets t for them
+	vmask intersect(uint lane, const RayPacket &packet, const vmask &mask, vfloat &t) const;
 };
 
 // A polygonal mesh.
 class Mesh : public Primitive {
 public:
-	Mesh(const std::string& fname);
+	// Load fname (ObjParser.hpp), or its MeshCache file if the mesh_cache
+	// setting is on and it is up to date. With multithreading on, loading
+	// carries on in the background on the shared ThreadPool until wait() or
+	// prepare().
+	//
+	// With lazy_meshes, only the bounds are found up front, and the rest is
+	// loaded by the first ray to enter them.
+	Mesh(const std::string& fname, const RenderSettings &settings = RenderSettings());
+	virtual ~Mesh();
+
+	// Block until the mesh is loaded and print how long it took. Not thread
+	// safe, call it from the thread setting up the scene.
+	void wait();
+
+	virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const override;
+	virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const override;
+	virtual bool occluded(const Ray &r, double t0, double t1) const override;
+	virtual vmask intersectPacket(RayPacket &packet, uint32_t *ids) const override;
+	virtual AABB bounds() const override;
+	virtual void prepare(const RenderSettings &settings) override;
+
+	// Triangle hierarchies, for statistics (empty until a lazy mesh is hit)
+	const BVH &bvh() const;
+	const WideBVH &wideBVH() const;
+
+	// Lazy loads finished by rays so far, over every mesh
+	struct LazyLoadStats {
+		uint64_t meshes;
+		double ms;
+	};
+	static LazyLoadStats lazyLoadStats();
+
+	// What the lazy loads since the last call had to say (see wait()), in
+	// the order they finished
+	static std::string takeLazyLoadLog();
 
-	virtual HitRecord hit(const Ray &r, double t0, double t1) const override;
-  
 private:
 	std::vector<glm::vec3> m_vertices;
 	std::vector<Triangle> m_faces;
 
-#ifdef ENABLE_BOUNDING_VOLUMES
+	// Triangle hierarchy, every leaf covers whole blocks of m_triangles
+	BVH m_bvh;
+	WideBVH m_wideBVH; // Collapsed from m_bvh, same leaves
+
+	// Faces in leaf order, SIMD_WIDTH per block, and their geometric normals
+	// (indexed by block * SIMD_WIDTH + lane), only read for the closest hit
+	std::vector<TriangleBlock> m_triangles;
+	std::vector<glm::vec3> m_normals;
+
+	void load();
+	void loadBounds(std::ostream &log);
+	void loadData(std::ostream &log);
+	void buildBVH(uint numThreads);
+
+	// Load a lazy mesh the first time a ray reaches its bounds. Returns false
+	// if the ray can't hit the mesh.
+	bool ensureLoaded(const Ray &r, double t0, double t1) const;
+	bool ensureLoaded(const RayPacket &packet) const;
+	void finishLazyLoad() const;
+
 	glm::vec3 m_boundingMin;
 	glm::vec3 m_boundingMax;
 	std::unique_ptr<Primitive> m_bv; // bounding volume
 
 	Primitive *boundingVolume(BoundingVolume volType = BoundingVolume::BoundingBox) const;
-#endif
+
+	// Acceleration settings of the current render, see prepare()
+	bool m_useBoundingVolume;
+	bool m_renderBoundingVolume;
+	BoundingVolume m_boundingVolumeType;
+	bool m_useBVH;
+	bool m_useWideBVH;
+
+	// What to load and how
+	std::string m_fname;
+	RenderSettings m_loadSettings;
+
+	// Background load started by the constructor, and what it has to say
+	ThreadPool::Task m_loading;
+	std::string m_loadLog;
+
+	// Lazy meshes: bounds are fixed before rendering, the data is loaded
+	// once by whichever worker gets there first
+	bool m_lazy;
+	AABB m_lazyBounds;
+	mutable std::once_flag m_lazyOnce;
+	mutable std::atomic<bool> m_loaded;
 
     friend std::ostream& operator<<(std::ostream& out, const Mesh& mesh);
+	friend class MeshCache;
 };
@@ -0,0 +1,264 @@
+// Spring 2020
+
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+#include "Mesh.hpp"
+
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace glm;
+
+static const char MAGIC[8] = { 'A', '4', 'M', 'E', 'S', 'H', '\0', '\0' };
+
+// Sections start on cache line boundaries of the file (and so of the mapping)
+static const uint64_t SECTION_ALIGNMENT = 64;
+
+enum Section {
+	Vertices,
+	Faces,
+	BVHNodes,
+	BVHIndices,
+	WideBVHNodes,
+	TriangleBlocks,
+	Normals,
+	NUM_SECTIONS
+};
+
+struct SectionInfo {
+	uint64_t offset;
+	uint64_t count;
+};
+
+// Everything that has to match for a cache to be usable
+struct LayoutKey {
+	uint32_t version;
+	uint32_t simdWidth;
+	uint32_t maxLeafSize;
+	uint32_t maxDepth;
+	uint32_t triangleSize;
+	uint32_t nodeSize;
+	uint32_t wideNodeSize;
+	uint32_t blockSize;
+
+	static LayoutKey current()
+	{
+		LayoutKey key;
+		key.version = MeshCache::VERSION;
+		key.simdWidth = SIMD_WIDTH;
+		key.maxLeafSize = BVH::MAX_LEAF_SIZE;
+		key.maxDepth = BVH::MAX_DEPTH;
+		key.triangleSize = sizeof(Triangle);
+		key.nodeSize = sizeof(BVHNode);
+		key.wideNodeSize = sizeof(WideBVHNode);
+		key.blockSize = sizeof(TriangleBlock);
+		return key;
+	}
+
+	bool operator==(const LayoutKey &other) const
+	{
+		return memcmp(this, &other, sizeof(LayoutKey)) == 0;
+	}
+};
+
+struct Header {
+	char magic[8];
+	LayoutKey layout;
+	uint64_t contentHash;
+
+	vec3 boundingMin;
+	vec3 boundingMax;
+
+	SectionInfo sections[NUM_SECTIONS];
+};
+
+// Section contents as a typed range of the mapping, nullptr if the header
+// points outside the file
+template<typename T>
+static const T *sectionData(const MappedFile &file, const Header &header, Section section)
+{
+	const SectionInfo &info = header.sections[section];
+
+	if(info.offset % SECTION_ALIGNMENT != 0 || info.offset > file.size())
+		return nullptr;
+	if(info.count > (file.size() - info.offset) / sizeof(T))
+		return nullptr;
+
+	return reinterpret_cast<const T *>(file.data() + info.offset);
+}
+
+template<typename T, typename Vector>
+static bool readSection(const MappedFile &file, const Header &header, Section section, Vector &out)
+{
+	const T *data = sectionData<T>(file, header, section);
+	if(!data)
+		return false;
+
+	out.assign(data, data + header.sections[section].count);
+	return true;
+}
+
+const uint32_t MeshCache::VERSION;
+
+string MeshCache::pathFor(const string &objPath)
+{
+	return objPath + ".meshcache";
+}
+
+// Map the cache and check that it is current
+static bool openCache(const string &path, uint64_t contentHash, MappedFile &file, Header &header)
+{
+	if(!file.open(path) || file.size() < sizeof(Header))
+		return false;
+
+	memcpy(&header, file.data(), sizeof(Header));
+
+	return memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+		&& header.layout == LayoutKey::current()
+		&& header.contentHash == contentHash;
+}
+
+bool MeshCache::loadBounds(const string &path, uint64_t contentHash, vec3 &min, vec3 &max)
+{
+	MappedFile file;
+	Header header;
+	if(!openCache(path, contentHash, file, header))
+		return false;
+
+	min = header.boundingMin;
+	max = header.boundingMax;
+	return true;
+}
+
+bool MeshCache::load(const string &path, uint64_t contentHash, Mesh &mesh)
+{
+	MappedFile file;
+	Header header;
+	if(!openCache(path, contentHash, file, header))
+		return false;
+
+	// Copy each section out of the mapping in one go, the mesh is only
+	// touched once everything checks out
+	vector<vec3> vertices;
+	vector<Triangle> faces;
+	vector<BVHNode> nodes;
+	vector<uint32_t> indices;
+	vector<TriangleBlock> triangles;
+	vector<vec3> normals;
+	const WideBVHNode *wideNodes = sectionData<WideBVHNode>(file, header, WideBVHNodes);
+
+	if(!wideNodes
+		|| !readSection<vec3>(file, header, Vertices, vertices)
+		|| !readSection<Triangle>(file, header, Faces, faces)
+		|| !readSection<BVHNode>(file, header, BVHNodes, nodes)
+		|| !readSection<uint32_t>(file, header, BVHIndices, indices)
+		|| !readSection<TriangleBlock>(file, header, TriangleBlocks, triangles)
+		|| !readSection<vec3>(file, header, Normals, normals))
+		return false;
+
+	// Leaves index whole blocks, one normal per slot
+	if(triangles.size() * SIMD_WIDTH != indices.size() || normals.size() != indices.size())
+		return false;
+
+	mesh.m_vertices = std::move(vertices);
+	mesh.m_faces = std::move(faces);
+	mesh.m_triangles = std::move(triangles);
+	mesh.m_normals = std::move(normals);
+	mesh.m_boundingMin = header.boundingMin;
+	mesh.m_boundingMax = header.boundingMax;
+
+	mesh.m_bvh.assign(std::move(nodes), std::move(indices), SIMD_WIDTH);
+	mesh.m_wideBVH.assign(wideNodes, header.sections[WideBVHNodes].count, mesh.m_bvh);
+
+	return true;
+}
+
+bool MeshCache::save(const string &path, uint64_t contentHash, const Mesh &mesh)
+{
+	Header header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.layout = LayoutKey::current();
+	header.contentHash = contentHash;
+	header.boundingMin = mesh.m_boundingMin;
+	header.boundingMax = mesh.m_boundingMax;
+
+	const WideBVH &wide = mesh.m_wideBVH;
+
+	// Contents of each section, in file order
+	const void *data[NUM_SECTIONS] = {
+		mesh.m_vertices.data(),
+		mesh.m_faces.data(),
+		mesh.m_bvh.nodes().data(),
+		mesh.m_bvh.indices().data(),
+		wide.nodes(),
+		mesh.m_triangles.data(),
+		mesh.m_normals.data()
+	};
+	const uint64_t bytes[NUM_SECTIONS] = {
+		mesh.m_vertices.size() * sizeof(vec3),
+		mesh.m_faces.size() * sizeof(Triangle),
+		mesh.m_bvh.nodes().size() * sizeof(BVHNode),
+		mesh.m_bvh.indices().size() * sizeof(uint32_t),
+		wide.numNodes() * sizeof(WideBVHNode),
+		mesh.m_triangles.size() * sizeof(TriangleBlock),
+		mesh.m_normals.size() * sizeof(vec3)
+	};
+	const uint64_t counts[NUM_SECTIONS] = {
+		mesh.m_vertices.size(),
+		mesh.m_faces.size(),
+		mesh.m_bvh.nodes().size(),
+		mesh.m_bvh.indices().size(),
+		wide.numNodes(),
+		mesh.m_triangles.size(),
+		mesh.m_normals.size()
+	};
+
+	auto align = [](uint64_t offset) {
+		return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+	};
+
+	uint64_t offset = align(sizeof(Header));
+	for(int s = 0; s < NUM_SECTIONS; ++s){
+		header.sections[s].offset = offset;
+		header.sections[s].count = counts[s];
+		offset = align(offset + bytes[s]);
+	}
+
+	// Write under a temporary name and rename, so concurrent renders never
+	// map a half written cache
+	const string tmpPath = path + "." + to_string(getpid()) + ".tmp";
+	{
+		ofstream out(tmpPath, ios::binary | ios::trunc);
+		if(!out)
+			return false;
+
+		const char zeros[SECTION_ALIGNMENT] = {};
+
+		out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+		uint64_t written = sizeof(Header);
+
+		for(int s = 0; s < NUM_SECTIONS; ++s){
+			out.write(zeros, header.sections[s].offset - written);
+			out.write(static_cast<const char *>(data[s]), bytes[s]);
+			written = header.sections[s].offset + bytes[s];
+		}
+
+		if(!out){
+			out.close();
+			remove(tmpPath.c_str());
+			return false;
+		}
+	}
+
+	if(rename(tmpPath.c_str(), path.c_str()) != 0){
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,36 @@
+// Spring 2020
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+class Mesh;
+
+// ------------------------------------------------------------
+// Binary cache of a mesh, stored next to its OBJ file as <obj>.meshcache.
+// Holds the vertices and faces along with everything built from them
+// (bounds, BVH, wide BVH, triangle blocks and normals), so a warm start
+// maps the file instead of parsing the OBJ and building the hierarchies.
+//
+// A cache is only used if it was written from the same OBJ contents (by
+// hash) and by a build with the same version and data layout, otherwise
+// it is rebuilt and replaced.
+class MeshCache {
+public:
+	// Bump whenever the layout or the way anything cached is built changes
+	static const uint32_t VERSION = 2;
+
+	static std::string pathFor(const std::string &objPath);
+
+	// Fill mesh from the cache at path, returns false if it is missing or stale
+	static bool load(const std::string &path, uint64_t contentHash, Mesh &mesh);
+
+	// Only the vertex bounds of an up to date cache, without reading the rest
+	static bool loadBounds(const std::string &path, uint64_t contentHash, glm::vec3 &min, glm::vec3 &max);
+
+	// Write mesh to path, returns false if the file couldn't be written
+	static bool save(const std::string &path, uint64_t contentHash, const Mesh &mesh);
+};
@@ -0,0 +1,214 @@
+// Spring 2020
+
+#include "ObjParser.hpp"
+#include "Epsilon.hpp"
+#include "ThreadPool.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// Smallest chunk worth a thread of its own
+static const size_t MIN_CHUNK_SIZE = 4 << 20;
+
+// Faces with relative indices, fixed up once the chunk's first vertex is known
+struct RelativeFace {
+	size_t face;
+	uint8_t corners; // Bit per corner (v1, v2, v3)
+};
+
+// Result of parsing one line aligned chunk. Indices are 0-based; relative
+// ones are stored relative to the chunk's first vertex (wrapping around if
+// they point into an earlier chunk).
+struct ObjChunk {
+	vector<vec3> vertices;
+	vector<Triangle> faces;
+	vector<RelativeFace> relative;
+
+	vec3 min = vec3(INF_FLOAT);
+	vec3 max = vec3(-INF_FLOAT);
+	size_t skippedLines = 0;
+};
+
+ObjData::ObjData()
+	: vertices(), faces(), min(INF_FLOAT), max(-INF_FLOAT), skippedLines(0)
+{}
+
+static const char *skipSpaces(const char *p, const char *end)
+{
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
+}
+
+static bool parseDouble(const char *&p, const char *end, double &value)
+{
+	p = skipSpaces(p, end);
+	if(p < end && *p == '+')
+		++p;
+
+	const auto result = from_chars(p, end, value);
+	if(result.ec != errc())
+		return false;
+
+	p = result.ptr;
+	return true;
+}
+
+// v x y z [w]
+static bool parseVertex(const char *p, const char *end, bool boundsOnly, ObjChunk &chunk)
+{
+	// Read as doubles and rounded once, the same as the old stream parser
+	double x, y, z;
+	if(!parseDouble(p, end, x) || !parseDouble(p, end, y) || !parseDouble(p, end, z))
+		return false;
+
+	const vec3 v(x, y, z);
+	if(!boundsOnly)
+		chunk.vertices.push_back(v);
+	chunk.min = glm::min(chunk.min, v);
+	chunk.max = glm::max(chunk.max, v);
+	return true;
+}
+
+// f v1[/vt1][/vn1] v2... with 3 or more vertices, triangulated as a fan
+static bool parseFace(const char *p, const char *end, ObjChunk &chunk)
+{
+	size_t first = 0, previous = 0;
+	uint8_t firstRelative = 0, previousRelative = 0;
+	uint count = 0;
+
+	while(true){
+		p = skipSpaces(p, end);
+		if(p == end || *p == '#')
+			break;
+
+		long long index;
+		const auto result = from_chars(p, end, index);
+		if(result.ec != errc() || index == 0)
+			return false;
+
+		// Skip the texture coordinate and normal indices
+		p = result.ptr;
+		while(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+			++p;
+
+		// Positive indices are absolute and 1-based, negative ones count back
+		// from the last vertex so far
+		const bool relative = index < 0;
+		const size_t vertex = relative
+			? size_t(static_cast<long long>(chunk.vertices.size()) + index)
+			: size_t(index - 1);
+
+		if(count == 0){
+			first = vertex;
+			firstRelative = relative;
+		} else if(count >= 2){
+			const uint8_t corners = firstRelative | (previousRelative << 1) | (uint8_t(relative) << 2);
+			if(corners)
+				chunk.relative.push_back({ chunk.faces.size(), corners });
+
+			chunk.faces.emplace_back(first, previous, vertex);
+		}
+
+		previous = vertex;
+		previousRelative = relative;
+		++count;
+	}
+
+	return count >= 3;
+}
+
+static void parseChunk(const char *p, const char *end, bool boundsOnly, ObjChunk &chunk)
+{
+	while(p < end){
+		const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+		if(!lineEnd)
+			lineEnd = end;
+
+		const char *q = skipSpaces(p, lineEnd);
+		const char *keyword = q;
+		while(q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r')
+			++q;
+
+		const size_t length = q - keyword;
+		bool ok = true;
+
+		if(length == 1 && keyword[0] == 'v')
+			ok = parseVertex(q, lineEnd, boundsOnly, chunk);
+		else if(length == 1 && keyword[0] == 'f' && !boundsOnly)
+			ok = parseFace(q, lineEnd, chunk);
+
+		if(!ok)
+			++chunk.skippedLines;
+
+		p = lineEnd + 1;
+	}
+}
+
+ObjData parseObj(const char *data, size_t size, uint numThreads, bool boundsOnly)
+{
+	const char *end = data + size;
+
+	// Split on line boundaries
+	const size_t numChunks = std::max<size_t>(1, std::min<size_t>(numThreads, size / MIN_CHUNK_SIZE));
+
+	vector<const char *> bounds(numChunks + 1, end);
+	bounds[0] = data;
+	for(size_t c = 1; c < numChunks; ++c){
+		const char *p = std::max(bounds[c - 1], data + size * c / numChunks);
+		const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+		bounds[c] = newline ? newline + 1 : end;
+	}
+
+	vector<ObjChunk> chunks(numChunks);
+	ThreadPool::shared().run(numChunks, [&](uint c) {
+		parseChunk(bounds[c], bounds[c + 1], boundsOnly, chunks[c]);
+	});
+
+	// Stitch the chunks together
+	ObjData obj;
+
+	size_t numVertices = 0, numFaces = 0;
+	for(const auto &chunk : chunks){
+		numVertices += chunk.vertices.size();
+		numFaces += chunk.faces.size();
+	}
+
+	obj.vertices.reserve(numVertices);
+	obj.faces.reserve(numFaces);
+
+	for(auto &chunk : chunks){
+		const size_t offset = obj.vertices.size();
+
+		// Unsigned arithmetic, wrapped relative indices come out right
+		for(const auto &rel : chunk.relative){
+			Triangle &face = chunk.faces[rel.face];
+			if(rel.corners & 1) face.v1 += offset;
+			if(rel.corners & 2) face.v2 += offset;
+			if(rel.corners & 4) face.v3 += offset;
+		}
+
+		obj.vertices.insert(obj.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+		obj.min = glm::min(obj.min, chunk.min);
+		obj.max = glm::max(obj.max, chunk.max);
+		obj.skippedLines += chunk.skippedLines;
+
+		vector<vec3>().swap(chunk.vertices);
+	}
+
+	// Drop faces referring to vertices that don't exist
+	for(auto &chunk : chunks){
+		for(const auto &face : chunk.faces){
+			if(face.v1 < numVertices && face.v2 < numVertices && face.v3 < numVertices)
+				obj.faces.push_back(face);
+			else
+				++obj.skippedLines;
+		}
+	}
+
+	return obj;
+}
@@ -0,0 +1,39 @@
+// Spring 2020
+
+#pragma once
+
+#include "Mesh.hpp"
+
+#include <vector>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+typedef unsigned int uint;
+
+// Geometry of an OBJ file, faces triangulated as fans
+struct ObjData {
+	ObjData();
+
+	std::vector<glm::vec3> vertices;
+	std::vector<Triangle> faces;
+
+	glm::vec3 min; // Vertex bounds
+	glm::vec3 max;
+
+	size_t skippedLines; // Malformed lines, and faces with out of range vertices
+};
+
+// ------------------------------------------------------------
+// Parse the OBJ file contents [data, data + size), e.g. a MappedFile.
+// Numbers are read with std::from_chars, and files larger than a few MiB
+// are split into line aligned chunks parsed by up to numThreads threads.
+//
+// Faces may use any of the f v, f v/vt, f v//vn and f v/vt/vn forms, with
+// negative (relative) indices, and polygons are split into triangles.
+// Normals, texture coordinates and everything else are skipped, meshes are
+// flat shaded.
+//
+// With boundsOnly, only min and max are filled in: vertices are measured
+// but not kept, and faces are skipped.
+ObjData parseObj(const char *data, size_t size, uint numThreads, bool boundsOnly = false);
@@ -1,47 +1,124 @@
 #pragma once
 
-// Comment this #define to hide the progress updates in cout
-// Note: Might gain a *slight* performance boost if disabled
-#define SHOW_PROGRESS
+// Default render settings. Every option below can be changed per run from
+// the command line (see Main.cpp) or per render through the optional
+// settings table of gr.render (see RenderSettings.hpp), no rebuild needed.
 
-// Comment this #define to disable multithreading
-#define ENABLE_MULTITHREADING
+// Show progress, ETA and throughput in cout, printed a few times a second
+// by a reporter thread (see Telemetry.hpp)
+const bool DEFAULT_SHOW_PROGRESS = true;
 
-/** Bounding Volumes **/
+// Render with every hardware thread, or only the calling thread if false
+const bool DEFAULT_MULTITHREADING = true;
+
+// Pin each thread of the render thread pool (ThreadPool.hpp) to its own CPU
+const bool DEFAULT_PIN_THREADS = false;
+
+// Width and height of the tiles workers render (and steal from each other)
+const unsigned int DEFAULT_TILE_SIZE = 16;
+
+enum TileOrder {
+	TileRows,    // Row by row, each worker starting on its own run of rows
+	TileMorton,  // Along a Z-order curve, dealt out to workers in turn
+	TileHilbert  // Along a Hilbert curve, dealt out to workers in turn
+};
+
+// Order tiles are rendered in (TileScheduler.hpp). Along a curve, workers
+// render neighbouring tiles at the same time and share the scene data they
+// touch in the caches.
+const TileOrder DEFAULT_TILE_ORDER = TileHilbert;
 
-// Comment this #define to disable bounding volume acceleration
-#define ENABLE_BOUNDING_VOLUMES
+// Count last level cache misses per worker with hardware performance
+// counters (CacheCounters.hpp), where the platform allows it
+const bool DEFAULT_CACHE_COUNTERS = false;
 
-// Uncomment this #define to render bounding volumes around objects
-//  * Bounding volume type is defined in Mesh.hpp
-//  * Automatically disabled if ENABLE_BOUNDING_VOLUMES is not defined
-// #define RENDER_BOUNDING_VOLUMES
+// Trace primary rays in packets of SIMD_WIDTH (Simd.hpp) rays instead of one
+// at a time
+const bool DEFAULT_RAY_PACKETS = true;
+
+// Trace each tile breadth first: all primary rays, then queues of shadow and
+// reflection rays sorted by direction octant and origin, instead of one
+// pixel at a time recursively
+const bool DEFAULT_WAVEFRONT = false;
+
+/** Bounding Volumes **/
 
 enum BoundingVolume {
 	BoundingBox,
 	BoundingSphere
 };
 
-// Default bounding volume is a bounding box (do not comment this out)
-#define BOUNDING_VOLUME BoundingBox
+// Cull meshes using a bounding volume
+const bool DEFAULT_BOUNDING_VOLUMES = true;
+
+// Default bounding volume is a bounding box
+const BoundingVolume DEFAULT_BOUNDING_VOLUME = BoundingBox;
+
+// Render bounding volumes around meshes instead of the meshes themselves
+//  * Ignored if bounding volumes are disabled
+const bool DEFAULT_RENDER_BOUNDING_VOLUMES = false;
+
+// Traverse each mesh's SAH bounding volume hierarchy (BVH.hpp) instead of
+// intersecting every triangle
+const bool DEFAULT_MESH_BVH = true;
+
+// Traverse a BVH over the world space bounds of the compiled scene's
+// instances (SceneBVH.hpp) instead of testing every instance
+// (CompiledScene.hpp)
+const bool DEFAULT_SCENE_BVH = true;
+
+// Traverse both hierarchies as 8-wide BVHs with quantised child boxes
+// (WideBVH.hpp), testing all children of a node at once
+//  * Ignored for hierarchies that are disabled
+const bool DEFAULT_WIDE_BVH = true;
+
+// Keep a binary cache of each mesh and its hierarchies next to the OBJ file
+// (MeshCache.hpp), so later runs map it instead of parsing and building
+const bool DEFAULT_MESH_CACHE = true;
+
+// Only find each mesh's bounds before rendering, and load the rest the first
+// time a ray enters them. Meshes no ray reaches are never loaded.
+const bool DEFAULT_LAZY_MESHES = false;
+
+// Lights are culled beyond the distance where their falloff brings them
+// below this intensity (LightBVH.hpp), 0 to shade every light everywhere
+const double DEFAULT_LIGHT_CUTOFF = 1.0 / 512.0;
+
+// Test the instance that last blocked a light's shadow rays on the same
+// worker before traversing the scene
+const bool DEFAULT_SHADOW_CACHE = true;
+
+
+/** Cost heatmap **/
+
+enum HeatmapMetric {
+	HeatmapOff,
+	HeatmapTime,  // Wall time spent tracing each pixel's samples
+	HeatmapSteps  // Box and triangle tests for each pixel's samples
+};
+
+// Also save <image>-heatmap.png, each pixel's cost in false colour
+const HeatmapMetric DEFAULT_HEATMAP = HeatmapOff;
 
 
 /** Supersampling (Main Additional Feature)**/
-// Comment this #define to enable Supersampling
-// #define ENABLE_SUPERSAMPLING
+// Disabled by default
+const bool DEFAULT_SUPERSAMPLING = false;
+
+// Super sampling factor, each pixel is sampled on an SS_FACTOR x SS_FACTOR grid
+const unsigned int DEFAULT_SS_FACTOR = 3;
 
-// Super sampling factor
-#ifdef ENABLE_SUPERSAMPLING
-#define SS_FACTOR 3.0
-#endif
+// Adaptive supersampling: sample pixel corners first, and only refine pixels
+// whose corners differ by more than the threshold (in any colour channel) on
+// the supersampling grid, stopping early once the samples agree
+const bool DEFAULT_ADAPTIVE_SUPERSAMPLING = false;
+const double DEFAULT_ADAPTIVE_THRESHOLD = 0.05;
 
 /** Reflection (BONUS) **/
 
-// Uncomment this #define to enable reflections
-// #define ENABLE_REFLECTIONS
+// Disabled by default
+const bool DEFAULT_REFLECTIONS = false;
 
-#ifdef ENABLE_REFLECTIONS
-// Comment this to use the default MAX_HITS in A4.hpp (1)
-#define MAX_HITS 5
-#define REFLECTION_MIX_FACTOR 0.25
-#endif
+// Maximum number of reflection bounces when reflections are enabled
+const unsigned int DEFAULT_MAX_HITS = 5;
+const double DEFAULT_REFLECTION_MIX_FACTOR = 0.25;
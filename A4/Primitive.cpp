@@ -15,11 +15,57 @@ using namespace glm;
 Primitive::~Primitive()
 {}
 
-HitRecord Primitive::hit(const Ray &r, double t0, double t1) const 
+bool Primitive::intersect(const Ray &, double, double &, uint32_t &) const
 {
-    return HitRecord();
+    return false;
 }
 
+void Primitive::surface(const Ray &, double, uint32_t, HitRecord &) const
+{}
+
+HitRecord Primitive::hit(const Ray &r, double t0, double t1) const
+{
+    HitRecord rec;
+    uint32_t id;
+
+    if(intersect(r, t0, t1, id)){
+        rec.hit = true;
+        rec.t = t1;
+        surface(r, t1, id, rec);
+    }
+
+    return rec;
+}
+
+bool Primitive::occluded(const Ray &r, double t0, double t1) const
+{
+    uint32_t id;
+    return intersect(r, t0, t1, id);
+}
+
+vmask Primitive::intersectPacket(RayPacket &packet, uint32_t *ids) const
+{
+    unsigned int hitLanes = 0;
+
+    forEachLane(packet.active, [&](unsigned int lane) {
+        double t1 = packet.tMax[lane];
+        if(intersect(packet.ray(lane), packet.tMin[lane], t1, ids[lane])){
+            packet.tMax.set(lane, float(t1));
+            hitLanes |= 1u << lane;
+        }
+    });
+
+    return vmask::fromBits(hitLanes);
+}
+
+AABB Primitive::bounds() const
+{
+    return AABB();
+}
+
+void Primitive::prepare(const RenderSettings &)
+{}
+
 // ------------------------------------------------------------
 // Non-hierarchal Sphere
 NonhierSphere::NonhierSphere(const glm::vec3& pos, double radius)
@@ -29,10 +75,9 @@ NonhierSphere::NonhierSphere(const glm::vec3& pos, double radius)
 NonhierSphere::~NonhierSphere()
 {}
 
-// Compute Ray-Sphere Intersection, store hit record in rec
-HitRecord NonhierSphere::hit(const Ray &r, double t0, double t1) const
+// Compute Ray-Sphere Intersection
+bool NonhierSphere::intersect(const Ray &r, double t0, double &t1, uint32_t &id) const
 {
-    HitRecord rec;
 	double t;
 
     const vec3 e(r.origin.x, r.origin.y, r.origin.z);
@@ -54,13 +99,24 @@ HitRecord NonhierSphere::hit(const Ray &r, double t0, double t1) const
 
 	// Check if solution exists and is in (t0, t1)
 	if(numRoots > 0 && t > t0 && t < t1){
-		rec.hit = true;
-		rec.t = t;
-		rec.point = r.pointAt(rec.t);
-		rec.n = rec.point - vec4(m_pos, 1);
+		t1 = t;
+		id = 0;
+		return true;
 	}
 
-    return rec;
+    return false;
+}
+
+void NonhierSphere::surface(const Ray &r, double t, uint32_t, HitRecord &rec) const
+{
+	rec.point = r.pointAt(t);
+	rec.n = rec.point - vec4(m_pos, 1);
+}
+
+AABB NonhierSphere::bounds() const
+{
+    const vec3 r(m_radius);
+    return AABB(m_pos - r, m_pos + r);
 }
 
 // ------------------------------------------------------------
@@ -76,11 +132,17 @@ NonhierBox::NonhierBox(const glm::vec3& pos, glm::vec3 size)
 NonhierBox::~NonhierBox()
 {}
 
-HitRecord NonhierBox::hit(const Ray &r, double t0, double t1) const 
+// Faces of the box are identified by axis * 2, +1 for the far (positive) face
+enum BoxFace : uint32_t {
+	Left, Right,
+	Down, Up,
+	Back, Front
+};
+
+bool NonhierBox::intersect(const Ray &r, double t0, double &t1, uint32_t &id) const
 {
-    HitRecord rec;
 	double t;
-	vec4 normal;
+	uint32_t face;
 
 	// Inverse ray direction here and then multiply moving forward
     const vec4 rayDirection = 1.0f / r.direction;
@@ -92,102 +154,114 @@ HitRecord NonhierBox::hit(const Ray &r, double t0, double t1) const
 	double tMin = (closeCorner.x - r.origin.x) * rayDirection.x;
 	double tMax = (farCorner.x - r.origin.x) * rayDirection.x;
 
-    // Left and right face normals
-	vec4 closeNormal(-1, 0, 0, 0);
-	vec4 farNormal(1, 0, 0, 0);
+    // Left and right faces
+	uint32_t closeFace = BoxFace::Left;
+	uint32_t farFace = BoxFace::Right;
 
     // Reverse t and normals if box is reversed
 	if(tMax < tMin){
 		std::swap(tMin, tMax);
-		std::swap(closeNormal, farNormal);
+		std::swap(closeFace, farFace);
 	}
 
 	// Solve for t using the y-interval
 	double y_tMin = (closeCorner.y - r.origin.y) * rayDirection.y;
 	double y_tMax = (farCorner.y - r.origin.y) * rayDirection.y;
 
-    // Down and up face normals
-	vec4 y_closeNormal(0, -1, 0, 0);
-	vec4 y_farNormal(0, 1, 0, 0);
+    // Down and up faces
+	uint32_t y_closeFace = BoxFace::Down;
+	uint32_t y_farFace = BoxFace::Up;
 
     // Reverse t and normals if box is reversed
 	if(y_tMax < y_tMin){
 		std::swap(y_tMin, y_tMax);
-		std::swap(y_closeNormal, y_farNormal);
+		std::swap(y_closeFace, y_farFace);
 	}
 
     // No solution if the x and y intervals do not overlapt
 	if(y_tMax < tMin or tMax < y_tMin)
-		return rec;
+		return false;
 
     // Properly set the lower bound
     // Lower bound = max(tMin, y_tMin)
 	if(std::isnan(tMin) || tMin < y_tMin){
 		tMin = y_tMin;
-		closeNormal = y_closeNormal;
+		closeFace = y_closeFace;
 	}
 
     // Properly set the upper bound
     // Upper bound = min(tMax, y_tMax)
 	if(std::isnan(tMax) || y_tMax < tMax){
 		tMax = y_tMax;
-		farNormal = y_farNormal;
+		farFace = y_farFace;
 	}
 
 	// Solve for t using the Z-interval
 	double z_tMin = (closeCorner.z - r.origin.z) * rayDirection.z;
 	double z_tMax = (farCorner.z -  r.origin.z) * rayDirection.z;
 
-    // Back and front face normals
-	vec4 z_closeNormal(0, 0, -1, 0);
-	vec4 z_farNormal(0, 0, 1, 0);
+    // Back and front faces
+	uint32_t z_closeFace = BoxFace::Back;
+	uint32_t z_farFace = BoxFace::Front;
 
     // Reverse t and normals if box is reversed
 	if(z_tMax < z_tMin){
 		std::swap(z_tMin, z_tMax);
-		std::swap(z_closeNormal, z_farNormal);
+		std::swap(z_closeFace, z_farFace);
 	}
 
     // No solution if the current interval and z-interval do not overlapt
 	if(z_tMax < tMin or tMax < z_tMin)
-		return rec;
+		return false;
 
     // Properly set the lower bound
     // Lower bound = max(tMin, z_tMin)
 	if(std::isnan(tMin) || tMin < z_tMin){
 		tMin = z_tMin;
-		closeNormal = z_closeNormal;
+		closeFace = z_closeFace;
 	}
 
     // Properly set the upper bound
     // Upper bound = min(tMax, z_tMax)
 	if(std::isnan(tMax) || z_tMax < tMax){
 		tMax = z_tMax;
-		farNormal = z_farNormal;
+		farFace = z_farFace;
 	}
 
     // Check that the intersection is within range
 	if(tMax < EPSILON)
-		return rec;
+		return false;
 
     // Check that the eye is not in the middle of the box
     // If it is, use tMax
 	if(tMin < EPSILON){
 		t = tMax;
-		normal = farNormal;
+		face = farFace;
 	} else {
 		t = tMin;
-		normal = closeNormal;
+		face = closeFace;
 	}
 
 	if(t > t0 && t < t1){
-		rec.hit = true;
-		rec.t = t;
-		rec.n = normal;
-		rec.point = r.pointAt(rec.t);
+		t1 = t;
+		id = face;
+		return true;
 	}
 
-    return rec;
+    return false;
+}
+
+void NonhierBox::surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const
+{
+	// Axis aligned normal of the face
+	rec.n = vec4(0);
+	rec.n[id / 2] = id % 2 ? 1.0f : -1.0f;
+	rec.point = r.pointAt(t);
+}
+
+AABB NonhierBox::bounds() const
+{
+    return AABB(m_pos, m_pos + m_size);
 }
 
 
@@ -200,9 +274,19 @@ Sphere::Sphere()
 Sphere::~Sphere()
 {}
 
-HitRecord Sphere::hit(const Ray &r, double t0, double t1) const
+bool Sphere::intersect(const Ray &r, double t0, double &t1, uint32_t &id) const
 {
-    return m_sphere.hit(r, t0, t1);
+    return m_sphere.intersect(r, t0, t1, id);
+}
+
+void Sphere::surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const
+{
+    m_sphere.surface(r, t, id, rec);
+}
+
+AABB Sphere::bounds() const
+{
+    return m_sphere.bounds();
 }
 
 // ------------------------------------------------------------
@@ -213,7 +297,17 @@ Cube::Cube(): m_box()
 Cube::~Cube()
 {}
 
-HitRecord Cube::hit(const Ray &r, double t0, double t1) const
+bool Cube::intersect(const Ray &r, double t0, double &t1, uint32_t &id) const
+{
+    return m_box.intersect(r, t0, t1, id);
+}
+
+void Cube::surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const
+{
+    m_box.surface(r, t, id, rec);
+}
+
+AABB Cube::bounds() const
 {
-    return m_box.hit(r, t0, t1);
+    return m_box.bounds();
 }
\ No newline at end of file
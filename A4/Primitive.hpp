@@ -4,6 +4,9 @@
 
 #include "Ray.hpp"
 #include "Epsilon.hpp"
+#include "BVH.hpp"
+#include "RayPacket.hpp"
+#include "RenderSettings.hpp"
 #include <utility>
 #include <glm/glm.hpp>
 
@@ -12,7 +15,30 @@
 class Primitive {
 public:
   virtual ~Primitive();
-  virtual HitRecord hit(const Ray &r, double t0, double t1) const;
+
+  // Closest intersection in (t0, t1). On a hit, t1 shrinks to it and id is
+  // set to what was hit (primitive specific, e.g. the triangle or box face).
+  virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const;
+
+  // Model space point and normal of a hit found by intersect
+  virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const;
+
+  // Closest intersection and its surface
+  HitRecord hit(const Ray &r, double t0, double t1) const;
+
+  // True if anything blocks the ray in (t0, t1), used for shadow rays
+  virtual bool occluded(const Ray &r, double t0, double t1) const;
+
+  // Closest intersections of the packet's active lanes within (tMin, tMax).
+  // Lanes that hit get their id and tMax updated, and are returned. Traces
+  // every lane on its own unless overridden.
+  virtual vmask intersectPacket(RayPacket &packet, uint32_t *ids) const;
+
+  // Model space bounds, empty if the primitive has no surface
+  virtual AABB bounds() const;
+
+  // Apply a render's settings before any rays are traced
+  virtual void prepare(const RenderSettings &settings);
 };
 
 // ------------------------------------------------------------
@@ -22,7 +48,9 @@ public:
   NonhierSphere(const glm::vec3& pos = glm::vec3(0), double radius = 1.0);
   virtual ~NonhierSphere();
 
-  virtual HitRecord hit(const Ray &r, double t0, double t1) const override;
+  virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const override;
+  virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const override;
+  virtual AABB bounds() const override;
 
 private:
   glm::vec3 m_pos;
@@ -37,7 +65,9 @@ public:
   NonhierBox(const glm::vec3& pos, glm::vec3 size);  
   virtual ~NonhierBox();
 
-  virtual HitRecord hit(const Ray &r, double t0, double t1) const override;
+  virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const override;
+  virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const override;
+  virtual AABB bounds() const override;
 
 private:
   glm::vec3 m_pos;
@@ -52,7 +82,9 @@ public:
   Sphere();
   virtual ~Sphere();
 
-  virtual HitRecord hit(const Ray &r, double t0, double t1) const override;
+  virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const override;
+  virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const override;
+  virtual AABB bounds() const override;
 
 private:
   NonhierSphere m_sphere;
@@ -65,7 +97,9 @@ public:
   Cube();
   virtual ~Cube();
 
-  virtual HitRecord hit(const Ray &r, double t0, double t1) const override;
+  virtual bool intersect(const Ray &r, double t0, double &t1, uint32_t &id) const override;
+  virtual void surface(const Ray &r, double t, uint32_t id, HitRecord &rec) const override;
+  virtual AABB bounds() const override;
 
 private:
   NonhierBox m_box;
@@ -57,6 +57,22 @@ Ray operator*(const mat4 &M, const Ray& r)
 }
 
 
+// ------------------------------------------------------------
+// RayHit
+const uint32_t RayHit::NONE;
+
+RayHit::RayHit()
+    : t(std::numeric_limits<double>::infinity()),
+      primitive(NONE),
+      instance(NONE)
+{}
+
+RayHit::operator bool() const
+{
+    return instance != NONE;
+}
+
+
 // ------------------------------------------------------------
 // HitRecord
 HitRecord::HitRecord(
@@ -5,6 +5,7 @@
 
 #include <string>
 #include <limits>
+#include <cstdint>
 
 struct Ray {
     Ray(const glm::vec4 &origin = glm::vec4(0,0,0,1), const glm::vec4 &direction = glm::vec4(0));
@@ -22,6 +23,22 @@ struct Ray {
 };
 Ray operator*(const glm::mat4 &M, const Ray& r);
 
+// What traversal keeps track of: the closest t so far and what was hit. The
+// surface (point, normal, material) is only filled into a HitRecord once the
+// closest hit is final, see CompiledScene::surface.
+struct RayHit {
+    RayHit();
+
+    static const uint32_t NONE = UINT32_MAX;
+
+    double t;           // Ray position of the closest intersection
+    uint32_t primitive; // What was hit within the primitive (e.g. triangle), see Primitive::intersect
+    uint32_t instance;  // Index of the hit instance in the compiled scene, NONE if nothing was hit
+
+    explicit operator bool() const;
+};
+
+// Surface at an intersection, used for shading
 struct HitRecord {
     HitRecord(
         bool hit = false, 
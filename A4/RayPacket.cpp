@@ -0,0 +1,74 @@
+// Spring 2020
+
+#include "RayPacket.hpp"
+
+using namespace std;
+using namespace glm;
+
+RayPacket::RayPacket(const Ray *rays, uint count, double t0, double t1)
+{
+	float lanes[6][SIMD_WIDTH] = {};
+
+	for(uint lane = 0; lane < count; ++lane){
+		const Ray &r = rays[lane];
+		lanes[0][lane] = r.origin.x;
+		lanes[1][lane] = r.origin.y;
+		lanes[2][lane] = r.origin.z;
+		lanes[3][lane] = r.direction.x;
+		lanes[4][lane] = r.direction.y;
+		lanes[5][lane] = r.direction.z;
+	}
+
+	ox = vfloat::load(lanes[0]);
+	oy = vfloat::load(lanes[1]);
+	oz = vfloat::load(lanes[2]);
+	dx = vfloat::load(lanes[3]);
+	dy = vfloat::load(lanes[4]);
+	dz = vfloat::load(lanes[5]);
+
+	invDx = vfloat(1.0f) / dx;
+	invDy = vfloat(1.0f) / dy;
+	invDz = vfloat(1.0f) / dz;
+
+	tMin = vfloat(float(t0));
+	tMax = vfloat(float(t1));
+
+	active = vmask::fromBits((1u << count) - 1);
+}
+
+RayPacket RayPacket::transform(const mat4 &M) const
+{
+	RayPacket packet;
+
+	// M is column major, M[column][row]
+	packet.ox = vfloat(M[0][0]) * ox + vfloat(M[1][0]) * oy + vfloat(M[2][0]) * oz + vfloat(M[3][0]);
+	packet.oy = vfloat(M[0][1]) * ox + vfloat(M[1][1]) * oy + vfloat(M[2][1]) * oz + vfloat(M[3][1]);
+	packet.oz = vfloat(M[0][2]) * ox + vfloat(M[1][2]) * oy + vfloat(M[2][2]) * oz + vfloat(M[3][2]);
+
+	packet.dx = vfloat(M[0][0]) * dx + vfloat(M[1][0]) * dy + vfloat(M[2][0]) * dz;
+	packet.dy = vfloat(M[0][1]) * dx + vfloat(M[1][1]) * dy + vfloat(M[2][1]) * dz;
+	packet.dz = vfloat(M[0][2]) * dx + vfloat(M[1][2]) * dy + vfloat(M[2][2]) * dz;
+
+	packet.invDx = vfloat(1.0f) / packet.dx;
+	packet.invDy = vfloat(1.0f) / packet.dy;
+	packet.invDz = vfloat(1.0f) / packet.dz;
+
+	packet.tMin = tMin;
+	packet.tMax = tMax;
+	packet.active = active;
+
+	return packet;
+}
+
+Ray RayPacket::ray(uint lane) const
+{
+	return Ray(
+		vec4(ox[lane], oy[lane], oz[lane], 1),
+		vec4(dx[lane], dy[lane], dz[lane], 0)
+	);
+}
+
+uint RayPacket::firstActive() const
+{
+	return uint(__builtin_ctz(active.bits()));
+}
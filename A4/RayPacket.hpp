@@ -0,0 +1,45 @@
+// Spring 2020
+
+#pragma once
+
+#include "Ray.hpp"
+#include "Simd.hpp"
+
+#include <glm/glm.hpp>
+
+typedef unsigned int uint;
+
+// ------------------------------------------------------------
+// Up to SIMD_WIDTH coherent rays (e.g. the primary rays of neighbouring
+// pixels) traced together, stored as a structure of arrays. Lanes without a
+// ray, or whose ray missed a node, are masked off by active.
+struct RayPacket {
+	RayPacket() {}
+	RayPacket(const Ray *rays, uint count, double t0, double t1);
+
+	// The same rays in the space given by the affine transform M, t is unchanged
+	RayPacket transform(const glm::mat4 &M) const;
+
+	// Lane as a single ray, for the scalar fallbacks
+	Ray ray(uint lane) const;
+
+	// Index of the first active lane
+	uint firstActive() const;
+
+	vfloat ox, oy, oz;       // Origins
+	vfloat dx, dy, dz;       // Directions
+	vfloat invDx, invDy, invDz; // 1 / direction
+
+	vfloat tMin;
+	vfloat tMax;             // Shrinks as closer hits are found
+
+	vmask active;
+};
+
+// Call fn(lane) for every lane set in mask
+template<typename Fn>
+inline void forEachLane(const vmask &mask, Fn &&fn)
+{
+	for(uint bits = mask.bits(); bits != 0; bits &= bits - 1)
+		fn(uint(__builtin_ctz(bits)));
+}
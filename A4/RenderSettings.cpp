@@ -0,0 +1,300 @@
+// Spring 2020
+
+#include "RenderSettings.hpp"
+#include "Simd.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+// Parse true/false style values
+static bool parseBool(const string &value, bool &result)
+{
+	if(value == "true" || value == "on" || value == "yes" || value == "1"){
+		result = true;
+		return true;
+	}
+
+	if(value == "false" || value == "off" || value == "no" || value == "0"){
+		result = false;
+		return true;
+	}
+
+	return false;
+}
+
+static bool parseUint(const string &value, uint &result)
+{
+	char *end = nullptr;
+	const long parsed = strtol(value.c_str(), &end, 10);
+
+	if(value.empty() || *end != '\0' || parsed < 0)
+		return false;
+
+	result = uint(parsed);
+	return true;
+}
+
+static bool parseDouble(const string &value, double &result)
+{
+	char *end = nullptr;
+	const double parsed = strtod(value.c_str(), &end);
+
+	if(value.empty() || *end != '\0')
+		return false;
+
+	result = parsed;
+	return true;
+}
+
+// Parse a setting that is either a boolean or a count enabling it, e.g.
+// supersampling = 3 or reflections = false
+static bool parseToggle(const string &value, bool &enabled, uint &count)
+{
+	if(parseBool(value, enabled))
+		return true;
+
+	uint parsed;
+	if(!parseUint(value, parsed))
+		return false;
+
+	enabled = parsed > 0;
+	if(enabled)
+		count = parsed;
+
+	return true;
+}
+
+
+// ------------------------------------------------------------
+// RenderSettings
+RenderSettings::RenderSettings()
+	: showProgress(DEFAULT_SHOW_PROGRESS),
+	  statsJson(),
+	  output(),
+	  multithreading(DEFAULT_MULTITHREADING),
+	  threads(0),
+	  pinThreads(DEFAULT_PIN_THREADS),
+	  tileSize(DEFAULT_TILE_SIZE),
+	  tileOrder(DEFAULT_TILE_ORDER),
+	  cacheCounters(DEFAULT_CACHE_COUNTERS),
+	  packets(DEFAULT_RAY_PACKETS),
+	  wavefront(DEFAULT_WAVEFRONT),
+	  boundingVolumes(DEFAULT_BOUNDING_VOLUMES),
+	  boundingVolume(DEFAULT_BOUNDING_VOLUME),
+	  renderBoundingVolumes(DEFAULT_RENDER_BOUNDING_VOLUMES),
+	  meshBVH(DEFAULT_MESH_BVH),
+	  sceneBVH(DEFAULT_SCENE_BVH),
+	  wideBVH(DEFAULT_WIDE_BVH),
+	  meshCache(DEFAULT_MESH_CACHE),
+	  lazyMeshes(DEFAULT_LAZY_MESHES),
+	  lightCutoff(DEFAULT_LIGHT_CUTOFF),
+	  shadowCache(DEFAULT_SHADOW_CACHE),
+	  heatmap(DEFAULT_HEATMAP),
+	  supersampling(DEFAULT_SUPERSAMPLING),
+	  ssFactor(DEFAULT_SS_FACTOR),
+	  adaptive(DEFAULT_ADAPTIVE_SUPERSAMPLING),
+	  adaptiveThreshold(DEFAULT_ADAPTIVE_THRESHOLD),
+	  reflections(DEFAULT_REFLECTIONS),
+	  maxHits(DEFAULT_MAX_HITS),
+	  reflectionMix(DEFAULT_REFLECTION_MIX_FACTOR)
+{}
+
+bool RenderSettings::set(const string &name, const string &value)
+{
+	// Accept both --tile-size and tile_size
+	string key(name);
+	std::replace(key.begin(), key.end(), '-', '_');
+
+	if(key == "progress")
+		return parseBool(value, showProgress);
+
+	if(key == "stats_json"){
+		statsJson = value;
+		return true;
+	}
+
+	if(key == "output"){
+		output = value;
+		return true;
+	}
+
+	if(key == "multithreading")
+		return parseBool(value, multithreading);
+
+	if(key == "threads")
+		return parseUint(value, threads);
+
+	if(key == "pin_threads")
+		return parseBool(value, pinThreads);
+
+	if(key == "tile_size")
+		return parseUint(value, tileSize) && tileSize > 0;
+
+	if(key == "tile_order"){
+		if(value == "rows")
+			tileOrder = TileRows;
+		else if(value == "morton")
+			tileOrder = TileMorton;
+		else if(value == "hilbert")
+			tileOrder = TileHilbert;
+		else
+			return false;
+
+		return true;
+	}
+
+	if(key == "cache_counters")
+		return parseBool(value, cacheCounters);
+
+	if(key == "packets")
+		return parseBool(value, packets);
+
+	if(key == "wavefront")
+		return parseBool(value, wavefront);
+
+	if(key == "bounding_volumes")
+		return parseBool(value, boundingVolumes);
+
+	if(key == "bounding_volume"){
+		if(value == "box")
+			boundingVolume = BoundingVolume::BoundingBox;
+		else if(value == "sphere")
+			boundingVolume = BoundingVolume::BoundingSphere;
+		else
+			return false;
+
+		return true;
+	}
+
+	if(key == "render_bounding_volumes")
+		return parseBool(value, renderBoundingVolumes);
+
+	if(key == "mesh_bvh")
+		return parseBool(value, meshBVH);
+
+	if(key == "scene_bvh")
+		return parseBool(value, sceneBVH);
+
+	if(key == "wide_bvh")
+		return parseBool(value, wideBVH);
+
+	if(key == "mesh_cache")
+		return parseBool(value, meshCache);
+
+	if(key == "lazy_meshes")
+		return parseBool(value, lazyMeshes);
+
+	if(key == "light_cutoff")
+		return parseDouble(value, lightCutoff) && lightCutoff >= 0.0;
+
+	if(key == "shadow_cache")
+		return parseBool(value, shadowCache);
+
+	if(key == "heatmap"){
+		bool enabled;
+		if(value == "time")
+			heatmap = HeatmapTime;
+		else if(value == "steps")
+			heatmap = HeatmapSteps;
+		else if(value == "off")
+			heatmap = HeatmapOff;
+		else if(parseBool(value, enabled))
+			heatmap = enabled ? HeatmapSteps : HeatmapOff;
+		else
+			return false;
+
+		return true;
+	}
+
+	if(key == "supersampling")
+		return parseToggle(value, supersampling, ssFactor);
+
+	if(key == "adaptive")
+		return parseBool(value, adaptive);
+
+	if(key == "adaptive_threshold")
+		return parseDouble(value, adaptiveThreshold) && adaptiveThreshold >= 0.0;
+
+	if(key == "reflections")
+		return parseToggle(value, reflections, maxHits);
+
+	if(key == "reflection_mix")
+		return parseDouble(value, reflectionMix);
+
+	return false;
+}
+
+uint RenderSettings::numWorkers() const
+{
+	if(!multithreading)
+		return 1;
+
+	if(threads > 0)
+		return threads;
+
+	return std::max(1u, thread::hardware_concurrency());
+}
+
+ostream &operator<<(ostream &out, const RenderSettings &settings)
+{
+	static const string boundingVolumeNames[2] = {
+		"Bounding Box",
+		"Bounding Sphere"
+	};
+
+	if(settings.multithreading)
+		out << "Multithreading enabled (" << settings.numWorkers() << " workers)" << endl;
+	else
+		out << "Multithreading disabled. " << endl;
+
+	if(settings.packets)
+		out << "Ray packets enabled (" << SIMD_WIDTH << " rays, " << SIMD_ISA << ")" << endl;
+
+	if(settings.wavefront)
+		out << "Wavefront tracing enabled (sorted shadow and reflection queues)" << endl;
+
+	if(settings.boundingVolumes){
+		out << "Bounding volume acceleration enabled (" << boundingVolumeNames[settings.boundingVolume] << ")" << endl;
+		if(settings.renderBoundingVolumes)
+			out << "Rendering bounding volumes" << endl;
+	} else {
+		out << "Bounding volume acceleration disabled" << endl;
+	}
+
+	if(settings.meshBVH)
+		out << "Mesh BVH acceleration enabled (SAH)" << endl;
+
+	if(settings.sceneBVH)
+		out << "Scene BVH acceleration enabled" << endl;
+
+	if(settings.wideBVH && (settings.meshBVH || settings.sceneBVH))
+		out << "Wide BVH traversal enabled (" << SIMD_WIDTH << " children, quantised)" << endl;
+
+	if(settings.lazyMeshes)
+		out << "Lazy mesh loading enabled" << endl;
+
+	if(settings.lightCutoff > 0.0)
+		out << "Light culling enabled (cutoff " << settings.lightCutoff << ")" << endl;
+
+	if(settings.shadowCache)
+		out << "Shadow occluder cache enabled" << endl;
+
+	if(settings.heatmap != HeatmapOff)
+		out << "Cost heatmap enabled (" << (settings.heatmap == HeatmapTime ? "time" : "steps") << ")" << endl;
+
+	if(settings.supersampling){
+		out << "Supersampling enabled (" << settings.ssFactor << "x" << settings.ssFactor;
+		if(settings.adaptive)
+			out << ", adaptive, threshold " << settings.adaptiveThreshold;
+		out << ")" << endl;
+	}
+
+	if(settings.reflections)
+		out << "Reflections enabled (" << settings.maxHits << " bounces)" << endl;
+
+	return out;
+}
@@ -0,0 +1,95 @@
+// Spring 2020
+
+#pragma once
+
+#include "Options.hpp"
+
+#include <string>
+#include <iosfwd>
+
+typedef unsigned int uint;
+
+// Runtime render settings, initialized from the defaults in Options.hpp.
+//
+// Settings are set by name, using the same names on the command line
+// (--supersampling=3, --no-reflections, ...) and in gr.render's optional
+// settings table ({supersampling = 3, reflections = false, ...}):
+//
+//   progress                 true/false
+//   stats_json               file to write the render's stats to as JSON,
+//                            "-" for cout, empty for none
+//   output                   file to save the image to instead of the one
+//                            given to gr.render, empty for that one
+//   multithreading           true/false
+//   threads                  number of workers, 0 for every hardware thread
+//   pin_threads              true/false, pin the pool's threads to CPUs
+//   tile_size                tile width and height in pixels
+//   tile_order               rows/morton/hilbert
+//   cache_counters           true/false, count last level cache misses
+//   packets                  true/false, trace primary rays in SIMD packets
+//   wavefront                true/false, trace tiles breadth first in sorted
+//                            ray queues
+//   bounding_volumes         true/false
+//   bounding_volume          box/sphere
+//   render_bounding_volumes  true/false
+//   mesh_bvh                 true/false
+//   scene_bvh                true/false
+//   wide_bvh                 true/false, traverse the BVHs 8 children at a time
+//   mesh_cache               true/false, load and save <obj>.meshcache files
+//                            (command line only, meshes load before gr.render)
+//   lazy_meshes              true/false, load meshes when a ray first reaches
+//                            them (command line only)
+//   light_cutoff             intensity below which attenuated lights are culled
+//   shadow_cache             true/false, try each light's last blocker first
+//   heatmap                  off/time/steps, also save <image>-heatmap.png
+//                            (true means steps)
+//   supersampling            true/false, or the supersampling factor
+//   adaptive                 true/false, only supersample pixels with contrast
+//   adaptive_threshold       colour contrast/noise that triggers refinement
+//   reflections              true/false, or the maximum number of bounces
+//   reflection_mix           how much of the reflected colour is mixed in
+struct RenderSettings {
+	RenderSettings();
+
+	// Set a setting from its name and textual value. Returns false if the
+	// name is unknown or the value can't be parsed.
+	bool set(const std::string &name, const std::string &value);
+
+	// Number of workers to render with
+	uint numWorkers() const;
+
+	bool showProgress;
+	std::string statsJson;
+	std::string output;
+	bool multithreading;
+	uint threads;
+	bool pinThreads;
+	uint tileSize;
+	TileOrder tileOrder;
+	bool cacheCounters;
+	bool packets;
+	bool wavefront;
+
+	bool boundingVolumes;
+	BoundingVolume boundingVolume;
+	bool renderBoundingVolumes;
+	bool meshBVH;
+	bool sceneBVH;
+	bool wideBVH;
+	bool meshCache;
+	bool lazyMeshes;
+	double lightCutoff;
+	bool shadowCache;
+	HeatmapMetric heatmap;
+
+	bool supersampling;
+	uint ssFactor;
+	bool adaptive;
+	double adaptiveThreshold;
+
+	bool reflections;
+	uint maxHits;
+	double reflectionMix;
+};
+
+std::ostream &operator<<(std::ostream &out, const RenderSettings &settings);
@@ -0,0 +1,103 @@
+// Spring 2020
+
+#include "SceneBVH.hpp"
+
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+SceneBVH::SceneBVH(const SceneNode *root, const RenderSettings &settings)
+	: CompiledScene(root, settings), m_bvh(), m_wideBVH(), m_useWideBVH(settings.wideBVH)
+{
+	vector<AABB> instanceBounds;
+	instanceBounds.reserve(m_instances.size());
+	for(const auto &instance : m_instances)
+		instanceBounds.push_back(instance.bounds);
+
+	m_bvh.build(instanceBounds, 1, settings.numWorkers());
+	m_wideBVH.build(m_bvh);
+
+	// Reorder instances so every leaf covers a contiguous range
+	vector<Instance> ordered;
+	ordered.reserve(m_instances.size());
+	for(const auto index : m_bvh.indices())
+		ordered.push_back(m_instances[index]);
+
+	m_instances = std::move(ordered);
+}
+
+RayHit SceneBVH::intersect(const Ray &r, double t0, double t1) const
+{
+	RayHit hit;
+	++traversalCounters.rays;
+
+	auto hitInstances = [&](uint32_t first, uint32_t count, double &tMax) {
+		bool found = false;
+
+		for(uint32_t idx = first; idx < first + count; ++idx){
+			const Instance &instance = m_instances[idx];
+
+			if(instance.primitive->intersect(instance.worldToModel * r, t0, tMax, hit.primitive)){
+				hit.t = tMax;
+				hit.instance = idx;
+				found = true;
+			}
+		}
+
+		return found;
+	};
+
+	if(m_useWideBVH)
+		m_wideBVH.hit(r, t0, t1, hitInstances);
+	else
+		m_bvh.hit(r, t0, t1, hitInstances);
+
+	return hit;
+}
+
+bool SceneBVH::occluded(const Ray &r, double t0, double t1, uint32_t *blocker) const
+{
+	++traversalCounters.rays;
+
+	auto occludedByInstances = [&](uint32_t first, uint32_t count) {
+		for(uint32_t idx = first; idx < first + count; ++idx){
+			if(occludedBy(idx, r, t0, t1)){
+				if(blocker)
+					*blocker = idx;
+				return true;
+			}
+		}
+
+		return false;
+	};
+
+	if(m_useWideBVH)
+		return m_wideBVH.occluded(r, t0, t1, occludedByInstances);
+
+	return m_bvh.occluded(r, t0, t1, occludedByInstances);
+}
+
+void SceneBVH::intersectPacket(RayPacket &packet, RayHit *hits) const
+{
+	traversalCounters.rays += __builtin_popcount(packet.active.bits());
+
+	auto hitInstances = [&](uint32_t first, uint32_t count, const vmask &mask) {
+		intersectInstances(first, count, mask, packet, hits);
+	};
+
+	if(m_useWideBVH)
+		m_wideBVH.hitPacket(packet, hitInstances);
+	else
+		m_bvh.hitPacket(packet, hitInstances);
+}
+
+const BVH &SceneBVH::bvh() const
+{
+	return m_bvh;
+}
+
+const WideBVH &SceneBVH::wideBVH() const
+{
+	return m_wideBVH;
+}
@@ -0,0 +1,37 @@
+// Spring 2020
+
+#pragma once
+
+#include "CompiledScene.hpp"
+#include "SceneNode.hpp"
+#include "BVH.hpp"
+#include "WideBVH.hpp"
+#include "Ray.hpp"
+#include "RenderSettings.hpp"
+
+// ------------------------------------------------------------
+// Top-level acceleration structure: a BVH over the world space bounds of
+// every instance in a compiled scene
+class SceneBVH : public CompiledScene {
+public:
+	SceneBVH(const SceneNode *root, const RenderSettings &settings);
+
+	// Closest intersection, only t and what was hit
+	RayHit intersect(const Ray &r, double t0, double t1) const;
+
+	// True if any instance blocks the ray in (t0, t1), and sets blocker to it
+	// if given
+	bool occluded(const Ray &r, double t0, double t1, uint32_t *blocker = nullptr) const;
+
+	// Closest intersections of a packet of rays
+	void intersectPacket(RayPacket &packet, RayHit *hits) const;
+
+	// Instance hierarchies, for statistics
+	const BVH &bvh() const;
+	const WideBVH &wideBVH() const;
+
+private:
+	BVH m_bvh;
+	WideBVH m_wideBVH; // Collapsed from m_bvh, same leaves
+	bool m_useWideBVH;
+};
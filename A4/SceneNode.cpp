@@ -188,4 +188,4 @@ HitRecord SceneNode::hit(
 	}
 
 	return rec;
-}
\ No newline at end of file
+}
@@ -0,0 +1,292 @@
+// Spring 2020
+
+#pragma once
+
+// 8 lane float vectors used by the ray packet kernels (RayPacket.hpp).
+//
+// Built on AVX when the compiler targets it (premake4 --avx2), as two SSE
+// halves on any other x86-64 target, and as plain loops everywhere else or
+// when SIMD_SCALAR is defined.
+
+#include <cstdint>
+
+#if defined(SIMD_SCALAR)
+	#define SIMD_ISA "scalar"
+#elif defined(__AVX__)
+	#include <immintrin.h>
+	#define SIMD_AVX
+	#define SIMD_ISA "AVX"
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define SIMD_SSE
+	#define SIMD_ISA "SSE"
+#else
+	#define SIMD_ISA "scalar"
+#endif
+
+const unsigned int SIMD_WIDTH = 8;
+
+// ------------------------------------------------------------
+// Per lane true/false, the result of comparing two vfloats
+struct vmask {
+#if defined(SIMD_AVX)
+	__m256 m;
+#elif defined(SIMD_SSE)
+	__m128 lo, hi;
+#else
+	unsigned int m;
+#endif
+
+	// Lane i is set if bit i is
+	static vmask fromBits(unsigned int bits);
+
+	// Bit i is set if lane i is
+	unsigned int bits() const;
+
+	bool any() const { return bits() != 0; }
+	bool none() const { return bits() == 0; }
+};
+
+// ------------------------------------------------------------
+// 8 floats operated on together
+struct vfloat {
+#if defined(SIMD_AVX)
+	__m256 v;
+#elif defined(SIMD_SSE)
+	__m128 lo, hi;
+#else
+	float v[SIMD_WIDTH];
+#endif
+
+	vfloat() {}
+	vfloat(float x); // Every lane set to x
+
+	static vfloat load(const float *p);
+	void store(float *p) const;
+
+	// Convert 8 unsigned bytes to floats
+	static vfloat fromBytes(const uint8_t *p);
+
+	// Single lane access, only meant for the scalar fallbacks
+	float operator[](unsigned int lane) const;
+	void set(unsigned int lane, float x);
+};
+
+vfloat operator+(const vfloat &a, const vfloat &b);
+vfloat operator-(const vfloat &a, const vfloat &b);
+vfloat operator*(const vfloat &a, const vfloat &b);
+vfloat operator/(const vfloat &a, const vfloat &b);
+
+// Like minps/maxps, b is returned in lanes where either is NaN
+vfloat min(const vfloat &a, const vfloat &b);
+vfloat max(const vfloat &a, const vfloat &b);
+
+vmask operator<(const vfloat &a, const vfloat &b);
+vmask operator<=(const vfloat &a, const vfloat &b);
+vmask operator>(const vfloat &a, const vfloat &b);
+vmask operator>=(const vfloat &a, const vfloat &b);
+
+vmask operator&(const vmask &a, const vmask &b);
+vmask operator|(const vmask &a, const vmask &b);
+
+// a and not b
+vmask andNot(const vmask &a, const vmask &b);
+
+// mask ? a : b per lane
+vfloat select(const vmask &mask, const vfloat &a, const vfloat &b);
+
+
+// ------------------------------------------------------------
+// AVX
+#if defined(SIMD_AVX)
+
+inline vmask vmask::fromBits(unsigned int bits)
+{
+	const __m256i lanes = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+	const __m256 bit = _mm256_and_ps(_mm256_castsi256_ps(_mm256_set1_epi32(int(bits))), _mm256_castsi256_ps(lanes));
+
+	return vmask{ _mm256_cmp_ps(bit, _mm256_setzero_ps(), _CMP_NEQ_UQ) };
+}
+
+inline unsigned int vmask::bits() const { return unsigned(_mm256_movemask_ps(m)); }
+
+inline vfloat::vfloat(float x) : v(_mm256_set1_ps(x)) {}
+
+inline vfloat vfloat::load(const float *p) { vfloat r; r.v = _mm256_loadu_ps(p); return r; }
+inline void vfloat::store(float *p) const { _mm256_storeu_ps(p, v); }
+
+inline vfloat vfloat::fromBytes(const uint8_t *p)
+{
+	const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+	vfloat r;
+#if defined(__AVX2__)
+	r.v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+#else
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i words = _mm_unpacklo_epi8(bytes, zero);
+	const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+	const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+	r.v = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+#endif
+	return r;
+}
+
+inline vfloat operator+(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_add_ps(a.v, b.v); return r; }
+inline vfloat operator-(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_sub_ps(a.v, b.v); return r; }
+inline vfloat operator*(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_mul_ps(a.v, b.v); return r; }
+inline vfloat operator/(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_div_ps(a.v, b.v); return r; }
+
+inline vfloat min(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_min_ps(a.v, b.v); return r; }
+inline vfloat max(const vfloat &a, const vfloat &b) { vfloat r; r.v = _mm256_max_ps(a.v, b.v); return r; }
+
+inline vmask operator<(const vfloat &a, const vfloat &b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline vmask operator<=(const vfloat &a, const vfloat &b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline vmask operator>(const vfloat &a, const vfloat &b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline vmask operator>=(const vfloat &a, const vfloat &b) { return vmask{ _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+inline vmask operator&(const vmask &a, const vmask &b) { return vmask{ _mm256_and_ps(a.m, b.m) }; }
+inline vmask operator|(const vmask &a, const vmask &b) { return vmask{ _mm256_or_ps(a.m, b.m) }; }
+inline vmask andNot(const vmask &a, const vmask &b) { return vmask{ _mm256_andnot_ps(b.m, a.m) }; }
+
+inline vfloat select(const vmask &mask, const vfloat &a, const vfloat &b)
+{
+	vfloat r;
+	r.v = _mm256_blendv_ps(b.v, a.v, mask.m);
+	return r;
+}
+
+
+// ------------------------------------------------------------
+// SSE, the low and high 4 lanes are processed separately
+#elif defined(SIMD_SSE)
+
+inline vmask vmask::fromBits(unsigned int bits)
+{
+	const __m128i lanesLo = _mm_set_epi32(8, 4, 2, 1);
+	const __m128i lanesHi = _mm_set_epi32(128, 64, 32, 16);
+	const __m128i b = _mm_set1_epi32(int(bits));
+
+	return vmask{
+		_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(b, lanesLo), lanesLo)),
+		_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(b, lanesHi), lanesHi))
+	};
+}
+
+inline unsigned int vmask::bits() const
+{
+	return unsigned(_mm_movemask_ps(lo)) | (unsigned(_mm_movemask_ps(hi)) << 4);
+}
+
+inline vfloat::vfloat(float x) : lo(_mm_set1_ps(x)), hi(lo) {}
+
+inline vfloat vfloat::load(const float *p) { vfloat r; r.lo = _mm_loadu_ps(p); r.hi = _mm_loadu_ps(p + 4); return r; }
+inline void vfloat::store(float *p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+
+inline vfloat vfloat::fromBytes(const uint8_t *p)
+{
+	// Zero extend bytes to 16 then 32 bits
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), zero);
+
+	vfloat r;
+	r.lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+	r.hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+	return r;
+}
+
+#define SIMD_SSE_OP(name, op) \
+	inline vfloat name(const vfloat &a, const vfloat &b) { vfloat r; r.lo = op(a.lo, b.lo); r.hi = op(a.hi, b.hi); return r; }
+
+SIMD_SSE_OP(operator+, _mm_add_ps)
+SIMD_SSE_OP(operator-, _mm_sub_ps)
+SIMD_SSE_OP(operator*, _mm_mul_ps)
+SIMD_SSE_OP(operator/, _mm_div_ps)
+SIMD_SSE_OP(min, _mm_min_ps)
+SIMD_SSE_OP(max, _mm_max_ps)
+
+#undef SIMD_SSE_OP
+
+inline vmask operator<(const vfloat &a, const vfloat &b) { return vmask{ _mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi) }; }
+inline vmask operator<=(const vfloat &a, const vfloat &b) { return vmask{ _mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi) }; }
+inline vmask operator>(const vfloat &a, const vfloat &b) { return vmask{ _mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi) }; }
+inline vmask operator>=(const vfloat &a, const vfloat &b) { return vmask{ _mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi) }; }
+
+inline vmask operator&(const vmask &a, const vmask &b) { return vmask{ _mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi) }; }
+inline vmask operator|(const vmask &a, const vmask &b) { return vmask{ _mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi) }; }
+inline vmask andNot(const vmask &a, const vmask &b) { return vmask{ _mm_andnot_ps(b.lo, a.lo), _mm_andnot_ps(b.hi, a.hi) }; }
+
+inline vfloat select(const vmask &mask, const vfloat &a, const vfloat &b)
+{
+	vfloat r;
+	r.lo = _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo));
+	r.hi = _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi));
+	return r;
+}
+
+
+// ------------------------------------------------------------
+// Scalar fallback
+#else
+
+inline vmask vmask::fromBits(unsigned int bits) { return vmask{ bits & 0xff }; }
+inline unsigned int vmask::bits() const { return m; }
+
+inline vfloat::vfloat(float x) { for(unsigned int i = 0; i < SIMD_WIDTH; ++i) v[i] = x; }
+
+inline vfloat vfloat::load(const float *p) { vfloat r; for(unsigned int i = 0; i < SIMD_WIDTH; ++i) r.v[i] = p[i]; return r; }
+inline void vfloat::store(float *p) const { for(unsigned int i = 0; i < SIMD_WIDTH; ++i) p[i] = v[i]; }
+inline vfloat vfloat::fromBytes(const uint8_t *p) { vfloat r; for(unsigned int i = 0; i < SIMD_WIDTH; ++i) r.v[i] = p[i]; return r; }
+
+#define SIMD_SCALAR_OP(name, expr) \
+	inline vfloat name(const vfloat &a, const vfloat &b) { vfloat r; for(unsigned int i = 0; i < SIMD_WIDTH; ++i) r.v[i] = expr; return r; }
+
+SIMD_SCALAR_OP(operator+, a.v[i] + b.v[i])
+SIMD_SCALAR_OP(operator-, a.v[i] - b.v[i])
+SIMD_SCALAR_OP(operator*, a.v[i] * b.v[i])
+SIMD_SCALAR_OP(operator/, a.v[i] / b.v[i])
+SIMD_SCALAR_OP(min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+SIMD_SCALAR_OP(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+
+#undef SIMD_SCALAR_OP
+
+#define SIMD_SCALAR_CMP(name, op) \
+	inline vmask name(const vfloat &a, const vfloat &b) { vmask r{ 0 }; for(unsigned int i = 0; i < SIMD_WIDTH; ++i) r.m |= unsigned(a.v[i] op b.v[i]) << i; return r; }
+
+SIMD_SCALAR_CMP(operator<, <)
+SIMD_SCALAR_CMP(operator<=, <=)
+SIMD_SCALAR_CMP(operator>, >)
+SIMD_SCALAR_CMP(operator>=, >=)
+
+#undef SIMD_SCALAR_CMP
+
+inline vmask operator&(const vmask &a, const vmask &b) { return vmask{ a.m & b.m }; }
+inline vmask operator|(const vmask &a, const vmask &b) { return vmask{ a.m | b.m }; }
+inline vmask andNot(const vmask &a, const vmask &b) { return vmask{ a.m & ~b.m }; }
+
+inline vfloat select(const vmask &mask, const vfloat &a, const vfloat &b)
+{
+	vfloat r;
+	for(unsigned int i = 0; i < SIMD_WIDTH; ++i)
+		r.v[i] = (mask.m >> i) & 1 ? a.v[i] : b.v[i];
+	return r;
+}
+
+#endif
+
+
+// ------------------------------------------------------------
+// Lane access, shared by every implementation
+inline float vfloat::operator[](unsigned int lane) const
+{
+	float lanes[SIMD_WIDTH];
+	store(lanes);
+	return lanes[lane];
+}
+
+inline void vfloat::set(unsigned int lane, float x)
+{
+	float lanes[SIMD_WIDTH];
+	store(lanes);
+	lanes[lane] = x;
+	*this = load(lanes);
+}
@@ -0,0 +1,238 @@
+// Spring 2020
+
+#include "Telemetry.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Add to a counter only its owner writes, no read-modify-write needed
+static void publish(atomic<uint64_t> &counter, uint64_t value)
+{
+	counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+const uint Telemetry::REPORT_INTERVAL_MS;
+
+Telemetry::Telemetry(uint numWorkers, uint width, uint height)
+	: m_numWorkers(std::max(1u, numWorkers)),
+	  m_numPixels(uint64_t(width) * height),
+	  m_slots(new Slot[m_numWorkers]),
+	  m_tileMs(m_numWorkers),
+	  m_start(Clock::now()),
+	  m_end(m_start),
+	  m_running(false),
+	  m_stopping(false)
+{}
+
+Telemetry::~Telemetry()
+{
+	stop();
+}
+
+void Telemetry::start(bool showProgress)
+{
+	m_start = Clock::now();
+	m_running = true;
+
+	if(showProgress){
+		m_stopping = false;
+		m_reporter = thread(&Telemetry::report, this);
+	}
+}
+
+void Telemetry::stop()
+{
+	if(!m_running)
+		return;
+
+	// The reporter reads m_running and m_end, so it stops first
+	const auto end = Clock::now();
+
+	const bool reporting = m_reporter.joinable();
+	if(reporting){
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_one();
+		m_reporter.join();
+	}
+
+	m_end = end;
+	m_running = false;
+
+	if(reporting)
+		printProgress(true);
+}
+
+void Telemetry::tileDone(uint worker, uint pixels, const TraversalCounters &counters, double ms)
+{
+	Slot &slot = m_slots[worker];
+
+	publish(slot.rays, counters.rays);
+	publish(slot.nodes, counters.nodes);
+	publish(slot.boxTests, counters.boxTests);
+	publish(slot.triangleTests, counters.triangleTests);
+	publish(slot.primaryRays, counters.primaryRays);
+	publish(slot.shadowRays, counters.shadowRays);
+	publish(slot.reflectionRays, counters.reflectionRays);
+	publish(slot.shadowCacheHits, counters.shadowCacheHits);
+	publish(slot.cacheReferences, counters.cacheReferences);
+	publish(slot.cacheMisses, counters.cacheMisses);
+	publish(slot.pixels, pixels);
+	publish(slot.tiles, 1);
+
+	m_tileMs[worker].push_back(float(ms));
+}
+
+TraversalCounters Telemetry::counters() const
+{
+	TraversalCounters total;
+
+	for(uint worker = 0; worker < m_numWorkers; ++worker){
+		const Slot &slot = m_slots[worker];
+
+		total.rays += slot.rays.load(memory_order_relaxed);
+		total.nodes += slot.nodes.load(memory_order_relaxed);
+		total.boxTests += slot.boxTests.load(memory_order_relaxed);
+		total.triangleTests += slot.triangleTests.load(memory_order_relaxed);
+		total.primaryRays += slot.primaryRays.load(memory_order_relaxed);
+		total.shadowRays += slot.shadowRays.load(memory_order_relaxed);
+		total.reflectionRays += slot.reflectionRays.load(memory_order_relaxed);
+		total.shadowCacheHits += slot.shadowCacheHits.load(memory_order_relaxed);
+		total.cacheReferences += slot.cacheReferences.load(memory_order_relaxed);
+		total.cacheMisses += slot.cacheMisses.load(memory_order_relaxed);
+	}
+
+	return total;
+}
+
+uint64_t Telemetry::tiles() const
+{
+	uint64_t total = 0;
+	for(uint worker = 0; worker < m_numWorkers; ++worker)
+		total += m_slots[worker].tiles.load(memory_order_relaxed);
+	return total;
+}
+
+uint64_t Telemetry::pixels() const
+{
+	uint64_t total = 0;
+	for(uint worker = 0; worker < m_numWorkers; ++worker)
+		total += m_slots[worker].pixels.load(memory_order_relaxed);
+	return total;
+}
+
+double Telemetry::traceMs() const
+{
+	const auto end = m_running ? Clock::now() : m_end;
+	return chrono::duration<double, milli>(end - m_start).count();
+}
+
+double Telemetry::mraysPerSecond() const
+{
+	const TraversalCounters total = counters();
+	const double ms = traceMs();
+	const uint64_t rays = total.primaryRays + total.shadowRays + total.reflectionRays;
+
+	return ms > 0.0 ? rays / ms * 1e-3 : 0.0;
+}
+
+void Telemetry::report()
+{
+	unique_lock<mutex> lock(m_mutex);
+
+	while(!m_wake.wait_for(lock, chrono::milliseconds(REPORT_INTERVAL_MS), [this]() { return m_stopping; }))
+		printProgress(false);
+}
+
+void Telemetry::printProgress(bool done) const
+{
+	const uint64_t pixelsDone = pixels();
+	const double fraction = m_numPixels > 0 ? double(pixelsDone) / m_numPixels : 1.0;
+	const double ms = traceMs();
+
+	// Assume the rest of the image costs the same per pixel as what's done
+	const double etaSeconds = fraction > 0.0 ? ms * (1.0 - fraction) / fraction * 1e-3 : 0.0;
+
+	const auto flags = cout.flags();
+	const auto precision = cout.precision();
+
+	cout << "\r" << std::fixed << std::setprecision(2) << fraction * 100.0 << "% done, "
+		 << std::setprecision(1) << "ETA " << etaSeconds << "s, "
+		 << std::setprecision(2) << mraysPerSecond() << " Mrays/s   ";
+	if(done)
+		cout << endl;
+	cout << std::flush;
+
+	cout.flags(flags);
+	cout.precision(precision);
+}
+
+void Telemetry::writeJson(ostream &out, const vector<WorkerStats> &workers,
+                          double preprocessingMs, double firstTileMs) const
+{
+	const TraversalCounters total = counters();
+	const uint64_t rays = total.primaryRays + total.shadowRays + total.reflectionRays;
+
+	// Tile times over every worker
+	vector<float> tileMs;
+	for(const auto &times : m_tileMs)
+		tileMs.insert(tileMs.end(), times.begin(), times.end());
+	std::sort(tileMs.begin(), tileMs.end());
+
+	double tileSum = 0.0;
+	for(const float ms : tileMs)
+		tileSum += ms;
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+
+	out << "{" << endl
+		<< "  \"pixels\": " << m_numPixels << "," << endl
+		<< "  \"workers\": " << m_numWorkers << "," << endl
+		<< "  \"tiles\": " << tiles() << "," << endl
+		<< "  \"preprocessing_ms\": " << preprocessingMs << "," << endl
+		<< "  \"first_tile_ms\": " << firstTileMs << "," << endl
+		<< "  \"trace_ms\": " << traceMs() << "," << endl
+		<< "  \"rays\": {" << endl
+		<< "    \"primary\": " << total.primaryRays << "," << endl
+		<< "    \"shadow\": " << total.shadowRays << "," << endl
+		<< "    \"reflection\": " << total.reflectionRays << "," << endl
+		<< "    \"total\": " << rays << "," << endl
+		<< "    \"traversed\": " << total.rays << endl
+		<< "  }," << endl
+		<< "  \"mrays_per_s\": " << mraysPerSecond() << "," << endl
+		<< "  \"nodes\": " << total.nodes << "," << endl
+		<< "  \"box_tests\": " << total.boxTests << "," << endl
+		<< "  \"triangle_tests\": " << total.triangleTests << "," << endl
+		<< "  \"shadow_cache_hits\": " << total.shadowCacheHits << "," << endl
+		<< "  \"cache_references\": " << total.cacheReferences << "," << endl
+		<< "  \"cache_misses\": " << total.cacheMisses << "," << endl
+		<< "  \"tile_ms\": {" << endl
+		<< "    \"min\": " << (tileMs.empty() ? 0.0 : tileMs.front()) << "," << endl
+		<< "    \"median\": " << (tileMs.empty() ? 0.0 : tileMs[tileMs.size() / 2]) << "," << endl
+		<< "    \"mean\": " << (tileMs.empty() ? 0.0 : tileSum / tileMs.size()) << "," << endl
+		<< "    \"max\": " << (tileMs.empty() ? 0.0 : tileMs.back()) << endl
+		<< "  }," << endl
+		<< "  \"worker_stats\": [";
+
+	for(size_t worker = 0; worker < workers.size(); ++worker){
+		const WorkerStats &stats = workers[worker];
+
+		out << (worker > 0 ? "," : "") << endl
+			<< "    { \"busy_ms\": " << stats.busyMs << ", \"tiles\": " << stats.tiles
+			<< ", \"stolen\": " << stats.stolen << " }";
+	}
+
+	out << endl << "  ]" << endl << "}" << endl;
+
+	out.flags(flags);
+	out.precision(precision);
+}
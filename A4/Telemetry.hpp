@@ -0,0 +1,87 @@
+// Spring 2020
+
+#pragma once
+
+#include "BVH.hpp"
+#include "TileScheduler.hpp"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+
+// ------------------------------------------------------------
+// Render telemetry. Each worker publishes its TraversalCounters to a cache
+// line of its own after every tile, without locks, and one reporter thread
+// prints progress, ETA and throughput at a fixed rate. The final summary
+// can be written as JSON for tracking throughput across runs.
+class Telemetry {
+public:
+	Telemetry(uint numWorkers, uint width, uint height);
+	~Telemetry();
+
+	// Start tracing, and print progress every REPORT_INTERVAL_MS until stop()
+	// if showProgress is set
+	void start(bool showProgress);
+	void stop();
+
+	// Publish what a worker did for a tile, called by that worker only
+	void tileDone(uint worker, uint pixels, const TraversalCounters &counters, double ms);
+
+	// Sums over every worker so far, safe to call while rendering
+	TraversalCounters counters() const;
+	uint64_t tiles() const;
+	uint64_t pixels() const;
+
+	// Time between start() and stop(), or until now while rendering
+	double traceMs() const;
+
+	// Primary, shadow and reflection rays per second, in millions
+	double mraysPerSecond() const;
+
+	// Write the summary of a finished render as a JSON object
+	void writeJson(std::ostream &out, const std::vector<WorkerStats> &workers,
+	               double preprocessingMs, double firstTileMs) const;
+
+	static const uint REPORT_INTERVAL_MS = 250;
+
+private:
+	// Written by one worker, read by anyone
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> tiles{0};
+		std::atomic<uint64_t> pixels{0};
+		std::atomic<uint64_t> rays{0};
+		std::atomic<uint64_t> nodes{0};
+		std::atomic<uint64_t> boxTests{0};
+		std::atomic<uint64_t> triangleTests{0};
+		std::atomic<uint64_t> primaryRays{0};
+		std::atomic<uint64_t> shadowRays{0};
+		std::atomic<uint64_t> reflectionRays{0};
+		std::atomic<uint64_t> shadowCacheHits{0};
+		std::atomic<uint64_t> cacheReferences{0};
+		std::atomic<uint64_t> cacheMisses{0};
+	};
+
+	void report();
+	void printProgress(bool done) const;
+
+	uint m_numWorkers;
+	uint64_t m_numPixels;
+	std::unique_ptr<Slot[]> m_slots;
+	std::vector<std::vector<float>> m_tileMs; // Per worker, read after stop()
+
+	std::chrono::steady_clock::time_point m_start;
+	std::chrono::steady_clock::time_point m_end;
+	bool m_running;
+
+	// Reporter thread, woken early by stop()
+	std::thread m_reporter;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stopping;
+};
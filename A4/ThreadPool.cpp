@@ -0,0 +1,232 @@
+// Spring 2020
+
+#include "ThreadPool.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+// ------------------------------------------------------------
+// ThreadPool::Task
+ThreadPool::Task::Task()
+	: m_pool(nullptr), m_state()
+{}
+
+ThreadPool::Task::Task(ThreadPool *pool, shared_ptr<TaskState> state)
+	: m_pool(pool), m_state(std::move(state))
+{}
+
+void ThreadPool::Task::wait()
+{
+	if(!m_state)
+		return;
+
+	// Not picked up yet, run it here rather than wait for a thread
+	if(!m_pool->execute(*m_state)){
+		unique_lock<mutex> lock(m_pool->m_mutex);
+		m_pool->m_finished.wait(lock, [this]() { return m_state->status == Done; });
+	}
+
+	const exception_ptr error = m_state->error;
+	m_state.reset();
+
+	if(error)
+		rethrow_exception(error);
+}
+
+bool ThreadPool::Task::valid() const
+{
+	return bool(m_state);
+}
+
+
+// ------------------------------------------------------------
+// ThreadPool
+ThreadPool &ThreadPool::shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool()
+	: m_threads(), m_queue(), m_stopping(false), m_pinned(false), m_affinityOk(true), m_threadsStarted(0), m_cpus()
+{
+#ifdef __linux__
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0){
+		for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+			if(CPU_ISSET(cpu, &cpus))
+				m_cpus.push_back(cpu);
+		}
+	}
+#endif
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_work.notify_all();
+
+	for(auto &thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::reserve(uint numThreads)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	while(m_threads.size() < numThreads){
+		const uint index = m_threads.size();
+		m_threads.emplace_back(&ThreadPool::work, this, index);
+		++m_threadsStarted;
+
+		if(m_pinned && !applyAffinity(index))
+			m_affinityOk = false;
+	}
+}
+
+bool ThreadPool::pin(bool enabled)
+{
+#ifdef __linux__
+	lock_guard<mutex> lock(m_mutex);
+
+	if(enabled == m_pinned)
+		return m_affinityOk;
+
+	m_pinned = enabled;
+	m_affinityOk = true;
+	for(uint index = 0; index < m_threads.size(); ++index){
+		if(!applyAffinity(index))
+			m_affinityOk = false;
+	}
+
+	return m_affinityOk;
+#else
+	return !enabled;
+#endif
+}
+
+// Called with m_mutex held, returns false if the affinity couldn't be set
+bool ThreadPool::applyAffinity(uint index)
+{
+#ifdef __linux__
+	if(m_cpus.empty())
+		return false;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if(m_pinned){
+		CPU_SET(m_cpus[(index + 1) % m_cpus.size()], &cpus);
+	} else {
+		for(const int cpu : m_cpus)
+			CPU_SET(cpu, &cpus);
+	}
+
+	return pthread_setaffinity_np(m_threads[index].native_handle(), sizeof(cpus), &cpus) == 0;
+#else
+	(void)index;
+	return false;
+#endif
+}
+
+uint ThreadPool::numThreads() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_threads.size();
+}
+
+bool ThreadPool::pinned() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_pinned;
+}
+
+uint ThreadPool::threadsStarted() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_threadsStarted;
+}
+
+ThreadPool::Task ThreadPool::submit(function<void()> fn)
+{
+	auto state = make_shared<TaskState>();
+	state->fn = std::move(fn);
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_queue.push_back(state);
+	}
+	m_work.notify_one();
+
+	return Task(this, state);
+}
+
+void ThreadPool::run(uint count, const function<void(uint)> &fn)
+{
+	if(count == 0)
+		return;
+
+	reserve(count - 1);
+
+	vector<Task> tasks;
+	tasks.reserve(count - 1);
+	for(uint worker = 1; worker < count; ++worker)
+		tasks.push_back(submit([&fn, worker]() { fn(worker); }));
+
+	fn(0);
+
+	for(auto &task : tasks)
+		task.wait();
+}
+
+bool ThreadPool::execute(TaskState &task)
+{
+	int expected = Queued;
+	if(!task.status.compare_exchange_strong(expected, Running))
+		return false;
+
+	try {
+		task.fn();
+	} catch(...) {
+		task.error = current_exception();
+	}
+	task.fn = nullptr;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		task.status = Done;
+	}
+	m_finished.notify_all();
+
+	return true;
+}
+
+void ThreadPool::work(uint)
+{
+	while(true){
+		shared_ptr<TaskState> task;
+
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_work.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+
+			if(m_queue.empty())
+				return;
+
+			task = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		// Skipped if a waiter already ran it
+		execute(*task);
+	}
+}
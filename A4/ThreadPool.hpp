@@ -0,0 +1,106 @@
+// Spring 2020
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+typedef unsigned int uint;
+
+// ------------------------------------------------------------
+// Process wide pool of worker threads, shared by every stage of every
+// render: mesh loading, BVH builds, tracing and PNG encoding. Threads are
+// started the first time a stage needs them and live until the process
+// exits, so scripts calling gr.render many times pay thread start-up once
+// and keep them warm.
+//
+// Waiting on a task that no thread has picked up yet runs it on the
+// waiting thread, so tasks may wait on tasks of their own (fork-join)
+// without deadlocking, and an empty pool runs everything inline.
+class ThreadPool {
+	struct TaskState;
+
+public:
+	// Handle to a submitted task
+	class Task {
+	public:
+		Task();
+
+		// Block until the task is done, running it here if it hasn't
+		// started. Rethrows anything the task threw.
+		void wait();
+
+		bool valid() const;
+
+	private:
+		friend class ThreadPool;
+		Task(ThreadPool *pool, std::shared_ptr<TaskState> state);
+
+		ThreadPool *m_pool;
+		std::shared_ptr<TaskState> m_state;
+	};
+
+	// The pool every render uses
+	static ThreadPool &shared();
+
+	ThreadPool();
+	~ThreadPool();
+
+	// Start threads until there are at least numThreads
+	void reserve(uint numThreads);
+
+	// Pin pool thread i to the (i + 1)th CPU the process may run on, leaving
+	// the first to the thread driving the render, or give every thread the
+	// process's CPUs back. Returns false if the affinity of any thread
+	// couldn't be set, and always when pinning off Linux.
+	bool pin(bool enabled);
+
+	uint numThreads() const;
+	bool pinned() const;
+
+	// Threads started over the life of the pool
+	uint threadsStarted() const;
+
+	// Queue fn for the next free thread
+	Task submit(std::function<void()> fn);
+
+	// Call fn(worker) for every worker in [0, count) and wait for all of
+	// them. Worker 0 runs on the calling thread, the others on the pool,
+	// which is grown to count - 1 threads if needed.
+	void run(uint count, const std::function<void(uint)> &fn);
+
+private:
+	enum Status { Queued, Running, Done };
+
+	struct TaskState {
+		std::function<void()> fn;
+		std::atomic<int> status{Queued};
+		std::exception_ptr error;
+	};
+
+	// Run a task if nobody else has claimed it, returns false if they have
+	bool execute(TaskState &task);
+	void work(uint index);
+	bool applyAffinity(uint index);
+
+	std::vector<std::thread> m_threads;
+	std::deque<std::shared_ptr<TaskState>> m_queue;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_work;     // Tasks queued, or stopping
+	std::condition_variable m_finished; // A task finished
+	bool m_stopping;
+	bool m_pinned;
+	bool m_affinityOk; // Every thread got the affinity m_pinned asks for
+	uint m_threadsStarted;
+
+	// CPUs the process was allowed to run on when the pool was created
+	std::vector<int> m_cpus;
+};
@@ -0,0 +1,245 @@
+// Spring 2020
+
+#include "TileScheduler.hpp"
+#include "ThreadPool.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double elapsedMs(const Clock::time_point &start, const Clock::time_point &end)
+{
+	return chrono::duration<double, milli>(end - start).count();
+}
+
+// Spread the low 16 bits of x out so a zero bit separates each
+static uint32_t spreadBits(uint32_t x)
+{
+	x &= 0xffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+// Position of (x, y) along the Z-order curve
+static uint64_t mortonIndex(uint32_t x, uint32_t y)
+{
+	return (uint64_t(spreadBits(y)) << 1) | spreadBits(x);
+}
+
+// Position of (x, y) along the Hilbert curve filling an n x n grid, n a
+// power of two
+static uint64_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+{
+	uint64_t d = 0;
+
+	for(uint32_t s = n / 2; s > 0; s /= 2){
+		const uint32_t rx = (x & s) ? 1 : 0;
+		const uint32_t ry = (y & s) ? 1 : 0;
+		d += uint64_t(s) * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant so the curve continues where it left off
+		if(ry == 0){
+			if(rx == 1){
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+
+	return d;
+}
+
+// ------------------------------------------------------------
+// Tile
+uint Tile::pixels() const
+{
+	return (x1 - x0) * (y1 - y0);
+}
+
+
+// ------------------------------------------------------------
+// TileScheduler
+TileScheduler::TileScheduler(uint width, uint height, uint tileSize, TileOrder order)
+	: m_tiles(), m_order(order), m_queues(), m_stats(), m_wallMs(0.0)
+{
+	tileSize = std::max(tileSize, 1u);
+
+	for(uint y = 0; y < height; y += tileSize){
+		for(uint x = 0; x < width; x += tileSize){
+			Tile tile;
+			tile.x0 = x;
+			tile.y0 = y;
+			tile.x1 = std::min(x + tileSize, width);
+			tile.y1 = std::min(y + tileSize, height);
+			m_tiles.push_back(tile);
+		}
+	}
+
+	if(order == TileRows)
+		return;
+
+	// The curves cover the smallest power of two grid holding every tile,
+	// tiles outside the image are skipped
+	const uint tilesX = (width + tileSize - 1) / tileSize;
+	const uint tilesY = (height + tileSize - 1) / tileSize;
+
+	uint n = 1;
+	while(n < tilesX || n < tilesY)
+		n *= 2;
+
+	vector<pair<uint64_t, Tile>> keyed;
+	keyed.reserve(m_tiles.size());
+
+	for(const Tile &tile : m_tiles){
+		const uint x = tile.x0 / tileSize;
+		const uint y = tile.y0 / tileSize;
+		keyed.emplace_back(order == TileMorton ? mortonIndex(x, y) : hilbertIndex(n, x, y), tile);
+	}
+
+	std::stable_sort(keyed.begin(), keyed.end(), [](const pair<uint64_t, Tile> &a, const pair<uint64_t, Tile> &b) {
+		return a.first < b.first;
+	});
+
+	for(size_t i = 0; i < keyed.size(); ++i)
+		m_tiles[i] = keyed[i].second;
+}
+
+void TileScheduler::run(uint numWorkers, const function<void(uint, const Tile &)> &renderTile)
+{
+	numWorkers = std::max(1u, std::min<uint>(numWorkers, m_tiles.size()));
+
+	m_queues.clear();
+	for(uint worker = 0; worker < numWorkers; ++worker)
+		m_queues.emplace_back(new WorkQueue());
+
+	if(m_order == TileRows){
+		// Hand every worker a contiguous run of tiles to start with
+		const size_t perWorker = (m_tiles.size() + numWorkers - 1) / numWorkers;
+		for(size_t i = 0; i < m_tiles.size(); ++i)
+			m_queues[i / perWorker]->tiles.push_back(m_tiles[i]);
+	} else {
+		// Deal the tiles out in curve order, so the workers move along the
+		// curve together
+		for(size_t i = 0; i < m_tiles.size(); ++i)
+			m_queues[i % numWorkers]->tiles.push_back(m_tiles[i]);
+	}
+
+	m_stats.assign(numWorkers, WorkerStats{0.0, 0, 0});
+
+	const auto start = Clock::now();
+
+	// Worker 0 is the calling thread, the rest come from the shared pool
+	// and stay up for the next render
+	ThreadPool::shared().run(numWorkers, [&](uint worker) {
+		work(worker, renderTile);
+	});
+
+	m_wallMs = elapsedMs(start, Clock::now());
+}
+
+void TileScheduler::work(uint worker, const function<void(uint, const Tile &)> &renderTile)
+{
+	// Accumulate locally, neighbouring workers' stats share cache lines
+	WorkerStats stats{0.0, 0, 0};
+	Tile tile;
+
+	while(true){
+		if(!pop(worker, tile)){
+			// Tiles are never added after the run starts, so once every
+			// queue is empty we're done
+			if(!steal(worker, tile))
+				break;
+
+			++stats.stolen;
+		}
+
+		const auto tileStart = Clock::now();
+		renderTile(worker, tile);
+		stats.busyMs += elapsedMs(tileStart, Clock::now());
+		++stats.tiles;
+	}
+
+	m_stats[worker] = stats;
+}
+
+// Owners take tiles from the front of their own queue, in image order
+bool TileScheduler::pop(uint worker, Tile &tile)
+{
+	WorkQueue &queue = *m_queues[worker];
+	lock_guard<mutex> lock(queue.mutex);
+
+	if(queue.tiles.empty())
+		return false;
+
+	tile = queue.tiles.front();
+	queue.tiles.pop_front();
+	return true;
+}
+
+// Thieves take tiles from the back of a victim's queue, furthest from
+// where the victim is currently working
+bool TileScheduler::steal(uint thief, Tile &tile)
+{
+	const uint numQueues = m_queues.size();
+
+	for(uint i = 1; i < numQueues; ++i){
+		WorkQueue &queue = *m_queues[(thief + i) % numQueues];
+		lock_guard<mutex> lock(queue.mutex);
+
+		if(!queue.tiles.empty()){
+			tile = queue.tiles.back();
+			queue.tiles.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t TileScheduler::numTiles() const
+{
+	return m_tiles.size();
+}
+
+TileOrder TileScheduler::order() const
+{
+	return m_order;
+}
+
+const vector<WorkerStats> &TileScheduler::stats() const
+{
+	return m_stats;
+}
+
+void TileScheduler::printStats(ostream &out) const
+{
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+
+	out << "Worker stats (" << m_tiles.size() << " tiles, "
+		<< std::fixed << std::setprecision(1) << m_wallMs << "ms wall):" << endl;
+
+	for(uint worker = 0; worker < m_stats.size(); ++worker){
+		const WorkerStats &stats = m_stats[worker];
+		const double utilization = m_wallMs > 0.0 ? 100.0 * stats.busyMs / m_wallMs : 0.0;
+
+		out << "\tworker " << worker << ": "
+			<< stats.busyMs << "ms busy (" << utilization << "%), "
+			<< stats.tiles << " tiles, "
+			<< stats.stolen << " stolen" << endl;
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
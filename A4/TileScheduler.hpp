@@ -0,0 +1,71 @@
+// Spring 2020
+
+#pragma once
+
+#include "Options.hpp"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <iosfwd>
+
+typedef unsigned int uint;
+
+// A rectangle of pixels, [x0, x1) x [y0, y1)
+struct Tile {
+	uint x0, y0;
+	uint x1, y1;
+
+	uint pixels() const;
+};
+
+// Per worker counters collected by TileScheduler::run
+struct WorkerStats {
+	double busyMs;  // Time spent rendering tiles
+	uint tiles;     // Tiles rendered
+	uint stolen;    // Tiles stolen from other workers
+};
+
+// ------------------------------------------------------------
+// Splits the image into square tiles and renders them on a pool of
+// workers. Each worker owns a deque of tiles, and steals from the other
+// workers' deques once its own runs dry, so expensive regions of the image
+// no longer leave the rest of the pool idle.
+//
+// Tiles are ordered along a space filling curve unless order is TileRows,
+// and dealt out to the workers in turn, so at any time the workers render
+// a compact patch of neighbouring tiles.
+class TileScheduler {
+public:
+	TileScheduler(uint width, uint height, uint tileSize, TileOrder order = DEFAULT_TILE_ORDER);
+
+	// Render every tile exactly once using numWorkers threads (the calling
+	// thread renders everything if numWorkers <= 1), as renderTile(worker, tile)
+	void run(uint numWorkers, const std::function<void(uint, const Tile &)> &renderTile);
+
+	size_t numTiles() const;
+	TileOrder order() const;
+	const std::vector<WorkerStats> &stats() const;
+
+	// Print per worker busy time and utilization of the last run
+	void printStats(std::ostream &out) const;
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+	};
+
+	void work(uint worker, const std::function<void(uint, const Tile &)> &renderTile);
+
+	bool pop(uint worker, Tile &tile);
+	bool steal(uint thief, Tile &tile);
+
+	std::vector<Tile> m_tiles;
+	TileOrder m_order;
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<WorkerStats> m_stats;
+	double m_wallMs;
+};
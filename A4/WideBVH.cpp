@@ -0,0 +1,201 @@
+// Spring 2020
+
+#include "WideBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+static_assert(sizeof(WideBVHNode) == 128, "WideBVHNode should fill two cache lines");
+
+// ------------------------------------------------------------
+// WideBVHNode
+AABB WideBVHNode::childBounds(uint32_t i) const
+{
+	AABB bounds;
+	for(int axis = 0; axis < 3; ++axis){
+		bounds.min[axis] = origin[axis] + float(lo[axis][i]) * scale(axis);
+		bounds.max[axis] = origin[axis] + float(hi[axis][i]) * scale(axis);
+	}
+	return bounds;
+}
+
+// Smallest power of two step that covers [min, max] in 255 steps from min
+static int quantisationExponent(float min, float max)
+{
+	const float extent = max - min;
+	if(!(extent > 0.0f))
+		return -126;
+
+	int exponent;
+	std::frexp(extent / 255.0f, &exponent);
+	exponent = std::max(exponent, -126);
+
+	// Rounding in min + 255 * step may still fall short of max
+	while(exponent < 127 && min + 255.0f * std::ldexp(1.0f, exponent) < max)
+		++exponent;
+
+	return exponent;
+}
+
+// Quantise a child box outwards, so the dequantised box always contains it
+static void quantise(const WideBVHNode &node, int axis, float min, float max, uint8_t &lo, uint8_t &hi)
+{
+	const float origin = node.origin[axis];
+	const float step = node.scale(axis);
+
+	int qlo = int(std::min(std::max(std::floor((min - origin) / step), 0.0f), 255.0f));
+	int qhi = int(std::min(std::max(std::ceil((max - origin) / step), 0.0f), 255.0f));
+
+	while(qlo > 0 && origin + float(qlo) * step > min)
+		--qlo;
+	while(qhi < 255 && origin + float(qhi) * step < max)
+		++qhi;
+
+	lo = uint8_t(qlo);
+	hi = uint8_t(qhi);
+}
+
+
+// ------------------------------------------------------------
+// WideBVH
+const uint32_t WideBVHNode::WIDTH;
+const uint32_t WideBVH::STACK_SIZE;
+
+WideBVH::WideBVH()
+	: m_nodes(), m_bounds()
+{}
+
+void WideBVH::build(const BVH &bvh)
+{
+	m_nodes.clear();
+	m_bounds = AABB();
+
+	if(bvh.empty())
+		return;
+
+	m_bounds = bvh.bounds();
+
+	// Roughly one wide node for every WIDTH - 1 binary interior nodes
+	m_nodes.reserve(bvh.nodes().size() / (WideBVHNode::WIDTH - 1) + 1);
+	collapse(bvh.nodes(), 0);
+	m_nodes.shrink_to_fit();
+}
+
+void WideBVH::assign(const WideBVHNode *nodes, size_t count, const BVH &bvh)
+{
+	m_nodes.assign(nodes, nodes + count);
+	m_bounds = bvh.empty() ? AABB() : bvh.bounds();
+}
+
+uint32_t WideBVH::collapse(const vector<BVHNode> &nodes, uint32_t index)
+{
+	// Open up the binary subtree, always expanding the interior node with the
+	// largest surface area, until there are WIDTH children
+	vector<uint32_t> children;
+	children.reserve(WideBVHNode::WIDTH);
+
+	if(nodes[index].count > 0){
+		children.push_back(index);
+	} else {
+		children.push_back(index + 1);
+		children.push_back(nodes[index].offset);
+	}
+
+	while(children.size() < WideBVHNode::WIDTH){
+		int best = -1;
+		float bestArea = -1.0f;
+		for(uint32_t i = 0; i < children.size(); ++i){
+			const BVHNode &child = nodes[children[i]];
+			if(child.count == 0 && child.bounds.surfaceArea() > bestArea){
+				best = i;
+				bestArea = child.bounds.surfaceArea();
+			}
+		}
+
+		if(best < 0)
+			break;
+
+		const uint32_t expanded = children[best];
+		children[best] = expanded + 1;
+		children.push_back(nodes[expanded].offset);
+	}
+
+	const uint32_t nodeIndex = m_nodes.size();
+	m_nodes.push_back(WideBVHNode());
+
+	// Children first, pushing may move the node
+	uint32_t childIndex[WideBVHNode::WIDTH];
+	for(uint32_t i = 0; i < children.size(); ++i){
+		const BVHNode &child = nodes[children[i]];
+		childIndex[i] = child.count > 0 ? child.offset : collapse(nodes, children[i]);
+	}
+
+	WideBVHNode &node = m_nodes[nodeIndex];
+	std::fill((uint8_t *)&node, (uint8_t *)(&node + 1), uint8_t(0));
+
+	AABB bounds;
+	for(uint32_t c : children)
+		bounds.expand(nodes[c].bounds);
+
+	node.origin = bounds.min;
+	node.numChildren = children.size();
+	for(int axis = 0; axis < 3; ++axis)
+		node.exponent[axis] = int8_t(quantisationExponent(bounds.min[axis], bounds.max[axis]));
+
+	for(uint32_t i = 0; i < children.size(); ++i){
+		const BVHNode &child = nodes[children[i]];
+		for(int axis = 0; axis < 3; ++axis)
+			quantise(node, axis, child.bounds.min[axis], child.bounds.max[axis], node.lo[axis][i], node.hi[axis][i]);
+
+		node.child[i] = childIndex[i];
+		node.count[i] = child.count;
+	}
+
+	return nodeIndex;
+}
+
+void WideBVH::pushSorted(const WideBVHNode &node, uint32_t mask, const vfloat &tNear,
+	StackEntry *stack, uint32_t &stackSize) const
+{
+	const uint32_t first = stackSize;
+
+	forEachLane(vmask::fromBits(mask), [&](uint i) {
+		const StackEntry entry = { node.child[i], node.count[i], tNear[i] };
+
+		// Insertion sort, farthest at the bottom
+		uint32_t j = stackSize++;
+		for(; j > first && stack[j - 1].tNear < entry.tNear; --j)
+			stack[j] = stack[j - 1];
+		stack[j] = entry;
+	});
+}
+
+const AABB &WideBVH::bounds() const
+{
+	return m_bounds;
+}
+
+bool WideBVH::empty() const
+{
+	return m_nodes.empty();
+}
+
+size_t WideBVH::memoryBytes() const
+{
+	return m_nodes.size() * sizeof(WideBVHNode);
+}
+
+size_t WideBVH::numNodes() const
+{
+	return m_nodes.size();
+}
+
+const WideBVHNode *WideBVH::nodes() const
+{
+	return m_nodes.data();
+}
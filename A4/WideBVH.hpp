@@ -0,0 +1,311 @@
+// Spring 2020
+
+#pragma once
+
+#include "BVH.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "Simd.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+
+#include <glm/glm.hpp>
+
+// ------------------------------------------------------------
+// Allocates on cache line boundaries, so nodes never straddle more cache
+// lines than they have to
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n)
+	{
+		void *p = nullptr;
+		if(posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+			throw std::bad_alloc();
+
+		return static_cast<T *>(p);
+	}
+
+	void deallocate(T *p, size_t) { free(p); }
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// ------------------------------------------------------------
+// 8-wide node (two cache lines). Child boxes are stored as 8 bit offsets
+// from the node's origin in steps of 2^exponent per axis, rounded outwards.
+struct WideBVHNode {
+	static const uint32_t WIDTH = SIMD_WIDTH;
+
+	glm::vec3 origin;       // Minimum corner of the node
+	int8_t exponent[3];     // Quantisation step per axis is 2^exponent
+	uint8_t numChildren;
+
+	uint8_t lo[3][WIDTH];   // Quantised child minimums, per axis
+	uint8_t hi[3][WIDTH];   // Quantised child maximums, per axis
+
+	uint32_t child[WIDTH];  // Leaf: index of first primitive, Interior: index of child node
+	uint16_t count[WIDTH];  // Number of primitives in leaf children, 0 for interior children
+
+	uint8_t pad[16];
+
+	// Step of the quantisation grid along an axis
+	float scale(int axis) const;
+
+	// Conservative bounds of a child
+	AABB childBounds(uint32_t i) const;
+
+	// Slab test of one ray against every child box at once, returns the
+	// children hit within [t0, t1] and the distance to each of them
+	vmask hit(const glm::vec3 &origin, const glm::vec3 &invDir, const bool *dirIsNeg,
+		float t0, float t1, vfloat &tNear) const;
+};
+
+// ------------------------------------------------------------
+// Wide bounding volume hierarchy, collapsed from a binary BVH. Leaves keep
+// the primitive ranges of the binary hierarchy's leaves, so primitives stay
+// in BVH::indices() order. Same traversal interface as BVH.
+class WideBVH {
+public:
+	WideBVH();
+
+	void build(const BVH &bvh);
+
+	// Adopt nodes collapsed earlier from bvh (e.g. loaded from MeshCache)
+	void assign(const WideBVHNode *nodes, size_t count, const BVH &bvh);
+
+	const AABB &bounds() const;
+	bool empty() const;
+
+	// Memory used by the nodes
+	size_t memoryBytes() const;
+	size_t numNodes() const;
+	const WideBVHNode *nodes() const;
+
+	// Closest hit traversal, visiting hit children nearest first
+	template<typename LeafFn>
+	bool hit(const Ray &r, double t0, double &t1, LeafFn &&leafHit) const;
+
+	// Any-hit traversal
+	template<typename LeafFn>
+	bool occluded(const Ray &r, double t0, double t1, LeafFn &&leafOccluded) const;
+
+	// Packet traversal, children are visited in the order of the first
+	// active ray
+	template<typename LeafFn>
+	void hitPacket(RayPacket &packet, LeafFn &&leafHit) const;
+
+	// Enough for the 7 siblings left behind on every level of the deepest tree
+	static const uint32_t STACK_SIZE = (WideBVHNode::WIDTH - 1) * BVH::MAX_DEPTH + WideBVHNode::WIDTH;
+
+private:
+	// A child waiting on the traversal stack
+	struct StackEntry {
+		uint32_t child;
+		uint16_t count;
+		float tNear;
+	};
+
+	uint32_t collapse(const std::vector<BVHNode> &nodes, uint32_t index);
+
+	// Push the children in mask onto the stack, the nearest ends up on top
+	void pushSorted(const WideBVHNode &node, uint32_t mask, const vfloat &tNear,
+		StackEntry *stack, uint32_t &stackSize) const;
+
+	std::vector<WideBVHNode, AlignedAllocator<WideBVHNode>> m_nodes;
+	AABB m_bounds;
+};
+
+// ------------------------------------------------------------
+// WideBVHNode
+inline float WideBVHNode::scale(int axis) const
+{
+	return std::ldexp(1.0f, exponent[axis]);
+}
+
+inline vmask WideBVHNode::hit(const glm::vec3 &o, const glm::vec3 &invDir, const bool *dirIsNeg,
+	float t0, float t1, vfloat &tNear) const
+{
+	vfloat tMin(t0), tMax(t1);
+
+	for(int axis = 0; axis < 3; ++axis){
+		// Dequantise, the near plane depends on the direction of the ray
+		const vfloat step(scale(axis));
+		const vfloat base(origin[axis] - o[axis]);
+		const vfloat lower = base + vfloat::fromBytes(lo[axis]) * step;
+		const vfloat upper = base + vfloat::fromBytes(hi[axis]) * step;
+
+		const vfloat inv(invDir[axis]);
+		const vfloat tEnter = (dirIsNeg[axis] ? upper : lower) * inv;
+		const vfloat tExit = (dirIsNeg[axis] ? lower : upper) * inv;
+
+		// NaNs (0 * inf) come first so they leave the interval untouched
+		tMin = ::max(tEnter, tMin);
+		tMax = ::min(tExit, tMax);
+	}
+
+	tNear = tMin;
+	return (tMin <= tMax) & vmask::fromBits((1u << numChildren) - 1);
+}
+
+
+// ------------------------------------------------------------
+// WideBVH traversal
+template<typename LeafFn>
+bool WideBVH::hit(const Ray &r, double t0, double &t1, LeafFn &&leafHit) const
+{
+	if(m_nodes.empty())
+		return false;
+
+	const glm::vec3 origin(r.origin);
+	const glm::vec3 invDir = 1.0f / glm::vec3(r.direction);
+	const bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	StackEntry stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+	bool hit = false;
+
+	stack[stackSize++] = { 0, 0, float(t0) };
+
+	while(stackSize > 0){
+		const StackEntry entry = stack[--stackSize];
+
+		// Skip anything behind the closest hit found since it was pushed
+		if(entry.tNear > t1)
+			continue;
+
+		if(entry.count > 0){
+			if(leafHit(entry.child, entry.count, t1))
+				hit = true;
+			continue;
+		}
+
+		const WideBVHNode &node = m_nodes[entry.child];
+		++traversalCounters.nodes;
+		traversalCounters.boxTests += node.numChildren;
+
+		vfloat tNear;
+		const uint32_t mask = node.hit(origin, invDir, dirIsNeg, float(t0), float(t1), tNear).bits();
+		pushSorted(node, mask, tNear, stack, stackSize);
+	}
+
+	return hit;
+}
+
+template<typename LeafFn>
+bool WideBVH::occluded(const Ray &r, double t0, double t1, LeafFn &&leafOccluded) const
+{
+	if(m_nodes.empty())
+		return false;
+
+	const glm::vec3 origin(r.origin);
+	const glm::vec3 invDir = 1.0f / glm::vec3(r.direction);
+	const bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	uint32_t stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+
+	stack[stackSize++] = 0;
+
+	while(stackSize > 0){
+		const WideBVHNode &node = m_nodes[stack[--stackSize]];
+		++traversalCounters.nodes;
+		traversalCounters.boxTests += node.numChildren;
+
+		vfloat tNear;
+		const vmask mask = node.hit(origin, invDir, dirIsNeg, float(t0), float(t1), tNear);
+
+		// Any order will do, test leaves straight away
+		bool found = false;
+		forEachLane(mask, [&](uint i) {
+			if(found)
+				return;
+
+			if(node.count[i] > 0)
+				found = leafOccluded(node.child[i], node.count[i]);
+			else
+				stack[stackSize++] = node.child[i];
+		});
+
+		if(found)
+			return true;
+	}
+
+	return false;
+}
+
+template<typename LeafFn>
+void WideBVH::hitPacket(RayPacket &packet, LeafFn &&leafHit) const
+{
+	if(m_nodes.empty() || packet.active.none())
+		return;
+
+	const uint32_t lane = packet.firstActive();
+	const glm::vec3 direction(packet.dx[lane], packet.dy[lane], packet.dz[lane]);
+
+	uint32_t stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+
+	stack[stackSize++] = 0;
+
+	while(stackSize > 0){
+		const WideBVHNode &node = m_nodes[stack[--stackSize]];
+		++traversalCounters.nodes;
+		traversalCounters.boxTests += node.numChildren;
+
+		// Children reached by any active ray, with their distance along the
+		// first active ray for ordering
+		uint32_t order[WideBVHNode::WIDTH];
+		float distance[WideBVHNode::WIDTH];
+		vmask masks[WideBVHNode::WIDTH];
+		uint32_t numHit = 0;
+
+		for(uint32_t i = 0; i < node.numChildren; ++i){
+			const AABB bounds = node.childBounds(i);
+			const vmask mask = bounds.hit(packet) & packet.active;
+			if(mask.none())
+				continue;
+
+			// Insertion sort, nearest first
+			const float d = glm::dot(bounds.centroid(), direction);
+			uint32_t j = numHit++;
+			for(; j > 0 && distance[j - 1] > d; --j){
+				distance[j] = distance[j - 1];
+				order[j] = order[j - 1];
+			}
+			distance[j] = d;
+			order[j] = i;
+			masks[i] = mask;
+		}
+
+		// Leaves right away nearest first, nodes pushed so the nearest is on top
+		for(uint32_t j = 0; j < numHit; ++j){
+			const uint32_t i = order[j];
+			if(node.count[i] > 0)
+				leafHit(node.child[i], node.count[i], masks[i]);
+		}
+
+		for(uint32_t j = numHit; j-- > 0;){
+			const uint32_t i = order[j];
+			if(node.count[i] == 0)
+				stack[stackSize++] = node.child[i];
+		}
+	}
+}
@@ -0,0 +1,449 @@
+// Spring 2020
+
+// Headless benchmark: renders scenes from A4/Assets under fixed settings and
+// thread counts, and reports wall time, Mrays/s, scaling efficiency, last
+// level cache misses (where hardware counters are available) and PSNR
+// against stored reference images as JSON and CSV. Exits with 1 if
+// throughput regressed against a baseline report or an image stopped
+// matching its reference.
+
+#include "../scene_lua.hpp"
+#include "../RenderSettings.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <lodepng/lodepng.h>
+
+using namespace std;
+
+struct BenchOptions {
+	string assets = "Assets";
+	vector<string> scenes = {
+		"simple", "nonhier", "nonhier2", "hier", "instance",
+		"macho-cows", "simple-cows", "mucho-macho-cows", "sample"
+	};
+	vector<uint> threads;
+	uint repeats = 3;
+
+	string outDir = "bench/out";
+	string referenceDir = "bench/reference";
+	string json = "bench-report.json";
+	string csv = "bench-report.csv";
+
+	bool updateReferences = false;
+	string baseline;        // CSV report of an earlier run
+	double threshold = 0.1; // Largest Mrays/s drop allowed against it
+	double minPsnr = 40.0;
+
+	RenderSettings settings; // Anything else given on the command line
+};
+
+struct BenchResult {
+	string scene;
+	uint threads;
+	double wallMs;     // Whole gr.render call, median of the repeats
+	double traceMs;    // Tracing only, median
+	double mrays;      // Primary, shadow and reflection rays, median
+	double efficiency; // Mrays/s per thread relative to the fewest threads
+	double psnr;       // Against the reference, negative if there is none
+	double cacheMisses; // Last level cache misses while tracing, median, 0 if unavailable
+};
+
+static void printUsage(const char *program)
+{
+	cerr << "Usage: " << program << " [options] [render settings]\n"
+	     << "\n"
+	     << "  --assets=<dir>            scenes and meshes (default Assets)\n"
+	     << "  --scenes=<a,b,...>        scene names without .lua\n"
+	     << "  --threads=<1,2,...>       thread counts (default 1, 2, 4, ... all cores)\n"
+	     << "  --repeats=<n>             timed runs per scene and thread count (default 3)\n"
+	     << "  --out=<dir>               rendered images (default bench/out)\n"
+	     << "  --references=<dir>        reference images (default bench/reference)\n"
+	     << "  --update-references       store this run's images as the references\n"
+	     << "  --json=<file>             JSON report (default bench-report.json)\n"
+	     << "  --csv=<file>              CSV report (default bench-report.csv)\n"
+	     << "  --baseline=<file.csv>     fail if Mrays/s dropped against this report\n"
+	     << "  --threshold=<fraction>    largest drop allowed (default 0.1)\n"
+	     << "  --min-psnr=<dB>           fail below this PSNR (default 40)\n"
+	     << "\n"
+	     << "Anything else is a render setting, as for A4 (e.g. --supersampling=3,\n"
+	     << "--tile-order=rows). Cache counters are on unless --no-cache-counters.\n";
+}
+
+static vector<string> split(const string &list)
+{
+	vector<string> items;
+	stringstream stream(list);
+	string item;
+
+	while(getline(stream, item, ','))
+		if(!item.empty())
+			items.push_back(item);
+
+	return items;
+}
+
+// Absolute version of a path relative to the current directory
+static string absolute(const string &path)
+{
+	if(path.empty() || path[0] == '/')
+		return path;
+
+	char cwd[4096];
+	if(!getcwd(cwd, sizeof(cwd)))
+		return path;
+
+	return string(cwd) + "/" + path;
+}
+
+static void makeDirectories(const string &path)
+{
+	for(size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)){
+		mkdir(path.substr(0, slash).c_str(), 0755);
+		if(slash == string::npos)
+			break;
+	}
+}
+
+static double median(vector<double> values)
+{
+	sort(values.begin(), values.end());
+	return values.empty() ? 0.0 : values[values.size() / 2];
+}
+
+// Number after "key": in a stats file written by Telemetry::writeJson
+static double jsonNumber(const string &json, const string &key)
+{
+	const size_t at = json.find("\"" + key + "\":");
+	return at == string::npos ? 0.0 : atof(json.c_str() + at + key.size() + 3);
+}
+
+// PSNR between two PNG files over every RGB channel, negative if either is
+// missing or the sizes differ, infinite if they are identical
+static double psnr(const string &imagePath, const string &referencePath)
+{
+	vector<unsigned char> image, reference;
+	unsigned w0, h0, w1, h1;
+
+	if(lodepng::decode(image, w0, h0, imagePath, LCT_RGB) || lodepng::decode(reference, w1, h1, referencePath, LCT_RGB))
+		return -1.0;
+	if(w0 != w1 || h0 != h1)
+		return -1.0;
+
+	double squaredError = 0.0;
+	for(size_t i = 0; i < image.size(); ++i){
+		const double d = double(image[i]) - reference[i];
+		squaredError += d * d;
+	}
+
+	if(squaredError == 0.0)
+		return INFINITY;
+
+	return 10.0 * log10(255.0 * 255.0 / (squaredError / image.size()));
+}
+
+static bool copyFile(const string &from, const string &to)
+{
+	ifstream in(from, ios::binary);
+	ofstream out(to, ios::binary);
+	out << in.rdbuf();
+	return bool(in) && bool(out);
+}
+
+// Render a scene once with the renderer's output silenced
+static bool render(const string &scene, const RenderSettings &settings, double &wallMs)
+{
+	streambuf *cout_buffer = cout.rdbuf(nullptr);
+
+	const auto start = chrono::steady_clock::now();
+	const bool ok = run_lua(scene + ".lua", settings);
+	wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout.rdbuf(cout_buffer);
+	return ok;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions &options)
+{
+	options.settings.showProgress = false;
+	options.settings.cacheCounters = true;
+
+	for(int i = 1; i < argc; ++i){
+		const string arg(argv[i]);
+		if(arg.compare(0, 2, "--") != 0)
+			return false;
+
+		// --name=value, --name or --no-name
+		string name = arg.substr(2);
+		string value = "true";
+
+		const size_t equals = name.find('=');
+		if(equals != string::npos){
+			value = name.substr(equals + 1);
+			name = name.substr(0, equals);
+		} else if(name.compare(0, 3, "no-") == 0){
+			name = name.substr(3);
+			value = "false";
+		}
+
+		if(name == "help")
+			return false;
+		else if(name == "assets")
+			options.assets = value;
+		else if(name == "scenes")
+			options.scenes = split(value);
+		else if(name == "threads"){
+			options.threads.clear();
+			for(const auto &count : split(value))
+				options.threads.push_back(uint(max(1, atoi(count.c_str()))));
+		}
+		else if(name == "repeats")
+			options.repeats = uint(max(1, atoi(value.c_str())));
+		else if(name == "out")
+			options.outDir = value;
+		else if(name == "references")
+			options.referenceDir = value;
+		else if(name == "update-references")
+			options.updateReferences = value == "true";
+		else if(name == "json")
+			options.json = value;
+		else if(name == "csv")
+			options.csv = value;
+		else if(name == "baseline")
+			options.baseline = value;
+		else if(name == "threshold")
+			options.threshold = atof(value.c_str());
+		else if(name == "min-psnr")
+			options.minPsnr = atof(value.c_str());
+		else if(!options.settings.set(name, value)){
+			cerr << "Invalid option " << arg << endl;
+			return false;
+		}
+	}
+
+	// 1, 2, 4, ... up to every hardware thread
+	if(options.threads.empty()){
+		const uint cores = max(1u, thread::hardware_concurrency());
+		for(uint count = 1; count < cores; count *= 2)
+			options.threads.push_back(count);
+		options.threads.push_back(cores);
+	}
+
+	return true;
+}
+
+// Mrays/s by scene and thread count from a CSV report
+static map<pair<string, uint>, double> readBaseline(const string &path)
+{
+	map<pair<string, uint>, double> baseline;
+	ifstream in(path);
+	string line;
+
+	getline(in, line); // Header
+	while(getline(in, line)){
+		const vector<string> fields = split(line);
+		if(fields.size() >= 5)
+			baseline[make_pair(fields[0], uint(atoi(fields[1].c_str())))] = atof(fields[4].c_str());
+	}
+
+	return baseline;
+}
+
+static void writeReports(const BenchOptions &options, const vector<BenchResult> &results)
+{
+	ofstream csv(options.csv);
+	csv << "scene,threads,wall_ms,trace_ms,mrays_per_s,efficiency,psnr,cache_misses" << endl;
+
+	ofstream json(options.json);
+	json << "{" << endl << "  \"repeats\": " << options.repeats << "," << endl << "  \"results\": [";
+
+	for(size_t i = 0; i < results.size(); ++i){
+		const BenchResult &r = results[i];
+		const bool hasPsnr = r.psnr >= 0.0 && std::isfinite(r.psnr);
+
+		csv << r.scene << "," << r.threads << "," << r.wallMs << "," << r.traceMs << ","
+		    << r.mrays << "," << r.efficiency << ",";
+		if(r.psnr >= 0.0)
+			csv << (hasPsnr ? r.psnr : 999.0);
+		csv << ",";
+		if(r.cacheMisses > 0.0)
+			csv << uint64_t(r.cacheMisses);
+		csv << endl;
+
+		json << (i > 0 ? "," : "") << endl
+		     << "    { \"scene\": \"" << r.scene << "\", \"threads\": " << r.threads
+		     << ", \"wall_ms\": " << r.wallMs << ", \"trace_ms\": " << r.traceMs
+		     << ", \"mrays_per_s\": " << r.mrays << ", \"efficiency\": " << r.efficiency
+		     << ", \"psnr\": ";
+		if(r.psnr < 0.0)
+			json << "null";
+		else
+			json << (hasPsnr ? r.psnr : 999.0);
+		json << ", \"cache_misses\": ";
+		if(r.cacheMisses > 0.0)
+			json << uint64_t(r.cacheMisses);
+		else
+			json << "null";
+		json << " }";
+	}
+
+	json << endl << "  ]" << endl << "}" << endl;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	if(!parseOptions(argc, argv, options)){
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	// Scenes load their meshes relative to the assets directory
+	const string outDir = absolute(options.outDir);
+	const string referenceDir = absolute(options.referenceDir);
+	options.json = absolute(options.json);
+	options.csv = absolute(options.csv);
+	options.baseline = absolute(options.baseline);
+
+	// Read before the reports are written, they may be the same file
+	map<pair<string, uint>, double> baseline;
+	if(!options.baseline.empty())
+		baseline = readBaseline(options.baseline);
+
+	makeDirectories(outDir);
+	if(options.updateReferences)
+		makeDirectories(referenceDir);
+
+	if(chdir(options.assets.c_str()) != 0){
+		cerr << "Could not open " << options.assets << endl;
+		return 2;
+	}
+
+	vector<BenchResult> results;
+	bool failed = false;
+
+	cout << left << setw(20) << "scene" << right << setw(8) << "threads" << setw(12) << "wall ms"
+	     << setw(12) << "trace ms" << setw(10) << "Mrays/s" << setw(12) << "efficiency" << setw(10) << "PSNR"
+	     << setw(14) << "LLC misses" << endl;
+
+	for(const string &scene : options.scenes){
+		double baseMrays = 0.0;
+		uint baseThreads = 0;
+
+		for(const uint threads : options.threads){
+			const string image = outDir + "/" + scene + "-" + to_string(threads) + ".png";
+			const string stats = outDir + "/" + scene + "-" + to_string(threads) + ".json";
+
+			RenderSettings settings(options.settings);
+			settings.multithreading = threads > 1;
+			settings.threads = threads;
+			settings.output = image;
+			settings.statsJson = stats;
+
+			// The first run loads meshes (and writes their caches), and isn't timed
+			double wallMs;
+			if(!render(scene, settings, wallMs)){
+				failed = true;
+				break;
+			}
+
+			vector<double> wall, trace, mrays, cacheMisses;
+			for(uint repeat = 0; repeat < options.repeats; ++repeat){
+				// A failed run leaves the previous run's stats behind, don't count them
+				if(!render(scene, settings, wallMs)){
+					cerr << scene << " (" << threads << " threads): repeat " << repeat + 1 << " failed" << endl;
+					failed = true;
+					continue;
+				}
+
+				ifstream in(stats);
+				const string json((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+				wall.push_back(wallMs);
+				trace.push_back(jsonNumber(json, "trace_ms"));
+				mrays.push_back(jsonNumber(json, "mrays_per_s"));
+				cacheMisses.push_back(jsonNumber(json, "cache_misses"));
+			}
+
+			BenchResult result;
+			result.scene = scene;
+			result.threads = threads;
+			result.wallMs = median(wall);
+			result.traceMs = median(trace);
+			result.mrays = median(mrays);
+			result.cacheMisses = median(cacheMisses);
+
+			if(baseThreads == 0){
+				baseMrays = result.mrays;
+				baseThreads = threads;
+			}
+			result.efficiency = baseMrays > 0.0 ? result.mrays / (baseMrays * threads / baseThreads) : 0.0;
+
+			const string reference = referenceDir + "/" + scene + ".png";
+			if(options.updateReferences && threads == options.threads.front())
+				copyFile(image, reference);
+			result.psnr = psnr(image, reference);
+
+			cout << left << setw(20) << scene << right << setw(8) << threads << fixed << setprecision(1)
+			     << setw(12) << result.wallMs << setw(12) << result.traceMs << setprecision(2)
+			     << setw(10) << result.mrays << setw(12) << result.efficiency << setprecision(1) << setw(10);
+			if(result.psnr < 0.0)
+				cout << "-";
+			else
+				cout << result.psnr;
+			cout << setw(14);
+			if(result.cacheMisses > 0.0)
+				cout << uint64_t(result.cacheMisses);
+			else
+				cout << "-";
+			cout << endl;
+
+			// Without a reference the image isn't checked at all, which must
+			// not pass silently (e.g. when run from another directory)
+			if(result.psnr < 0.0){
+				cerr << scene << " (" << threads << " threads): no reference image of the same size at "
+				     << reference << ", run with --update-references to store one" << endl;
+				failed = true;
+			} else if(result.psnr < options.minPsnr){
+				cerr << scene << " (" << threads << " threads): PSNR " << result.psnr
+				     << " dB is below " << options.minPsnr << " dB" << endl;
+				failed = true;
+			}
+
+			results.push_back(result);
+		}
+	}
+
+	writeReports(options, results);
+
+	// Throughput regressions against an earlier report
+	for(const BenchResult &result : results){
+		const auto entry = baseline.find(make_pair(result.scene, result.threads));
+		if(entry == baseline.end() || entry->second <= 0.0)
+			continue;
+
+		const double change = result.mrays / entry->second - 1.0;
+		if(change < -options.threshold){
+			cerr << result.scene << " (" << result.threads << " threads): " << result.mrays
+			     << " Mrays/s is " << -change * 100.0 << "% below the baseline's " << entry->second << endl;
+			failed = true;
+		}
+	}
+
+	cout << "Wrote " << options.json << " and " << options.csv << endl;
+	return failed ? 1 : 0;
+}
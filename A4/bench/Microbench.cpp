@@ -0,0 +1,473 @@
+// Spring 2020
+
+// Microbenchmarks of the hot kernels on their own: primitive, triangle,
+// mesh and scene intersection, and the polynomial solvers. Each kernel runs
+// over pre-generated batches of inputs in several orders:
+//
+//   coherent  camera rays in scanline order, neighbours take the same path
+//   sorted    the same rays, misses first, so hit/miss branches are predictable
+//   shuffled  the same rays in random order, same hit rate, unpredictable
+//   random    random origins and directions around the object
+//
+// The gap between sorted and shuffled is what branch mispredictions (and
+// incoherent memory access) cost the kernel. Reported as ns per test and
+// hit rate.
+
+#include "../scene_lua.hpp"
+#include "../RenderSettings.hpp"
+#include "../Primitive.hpp"
+#include "../Mesh.hpp"
+#include "../SceneNode.hpp"
+#include "../CompiledScene.hpp"
+#include "../SceneBVH.hpp"
+#include "../polyroots.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+struct MicroOptions {
+	string assets = "Assets";
+	string filter;      // Only kernels whose name contains this
+	string csv;         // Also write the results here
+	uint side = 256;    // Batches hold side x side inputs
+	uint repeats = 5;   // Timed rounds, the fastest is reported
+	double minMs = 50;  // Shortest round, the batch is rerun until it is reached
+	uint seed = 488;
+};
+
+struct MicroResult {
+	string kernel;
+	string order;
+	size_t tests;
+	double ns;      // Per test, fastest round
+	double hitRate;
+};
+
+// Keeps results alive so the compiler can't drop the work
+static volatile size_t sink;
+
+// ------------------------------------------------------------
+// Timing
+
+// Time test over every item of batch, returns ns per test and the hit rate
+template<typename T, typename Test>
+static MicroResult measure(const MicroOptions &options, const vector<T> &batch, Test test)
+{
+	using Clock = chrono::steady_clock;
+
+	MicroResult result;
+	result.tests = batch.size();
+	result.ns = INFINITY;
+
+	size_t hits = 0;
+	for(const T &item : batch)
+		hits += test(item) ? 1 : 0;
+	result.hitRate = batch.empty() ? 0.0 : double(hits) / batch.size();
+
+	for(uint round = 0; round < options.repeats; ++round){
+		const auto start = Clock::now();
+		size_t passes = 0;
+		double ms;
+
+		do {
+			for(const T &item : batch)
+				hits += test(item) ? 1 : 0;
+			++passes;
+			ms = chrono::duration<double, milli>(Clock::now() - start).count();
+		} while(ms < options.minMs);
+
+		result.ns = std::min(result.ns, ms * 1e6 / (double(passes) * batch.size()));
+	}
+
+	sink = sink + hits;
+	return result;
+}
+
+// Same items, misses first
+template<typename T, typename Test>
+static vector<T> sortedByOutcome(const vector<T> &batch, Test test)
+{
+	vector<T> sorted(batch);
+	stable_partition(sorted.begin(), sorted.end(), [&](const T &item) { return !test(item); });
+	return sorted;
+}
+
+template<typename T>
+static vector<T> shuffled(const vector<T> &batch, mt19937 &rng)
+{
+	vector<T> result(batch);
+	shuffle(result.begin(), result.end(), rng);
+	return result;
+}
+
+// ------------------------------------------------------------
+// Ray batches
+
+// side x side pinhole camera rays in scanline order
+static vector<Ray> cameraRays(uint side, const vec3 &eye, const vec3 &target, const vec3 &up, double fov)
+{
+	const vec3 w = normalize(target - eye);
+	const vec3 u = normalize(cross(w, up));
+	const vec3 v = cross(u, w);
+	const float extent = float(glm::tan(glm::radians(fov / 2)));
+
+	vector<Ray> rays;
+	rays.reserve(side * side);
+
+	for(uint y = 0; y < side; ++y){
+		for(uint x = 0; x < side; ++x){
+			const float sx = ((x + 0.5f) / side * 2.0f - 1.0f) * extent;
+			const float sy = (1.0f - (y + 0.5f) / side * 2.0f) * extent;
+			rays.emplace_back(vec4(eye, 1), vec4(normalize(w + sx * u + sy * v), 0));
+		}
+	}
+
+	return rays;
+}
+
+// Camera rays framing bounds from an oblique angle
+static vector<Ray> framingRays(uint side, const AABB &bounds)
+{
+	const vec3 centre = bounds.centroid();
+	const float radius = length(bounds.max - bounds.min) * 0.5f;
+	const vec3 eye = centre + normalize(vec3(0.3f, 0.4f, 1.0f)) * radius * 3.0f;
+
+	return cameraRays(side, eye, centre, vec3(0, 1, 0), 2.0 * glm::degrees(glm::asin(1.0 / 3.0)));
+}
+
+// Rays from random points around bounds towards random points near it, or
+// between random points inside it if inside is set
+static vector<Ray> randomRays(size_t count, const AABB &bounds, bool inside, mt19937 &rng)
+{
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+	normal_distribution<float> normal;
+
+	const vec3 centre = bounds.centroid();
+	const vec3 size = bounds.max - bounds.min;
+	const float radius = length(size) * 0.5f;
+
+	auto sphere = [&]() {
+		const vec3 p(normal(rng), normal(rng), normal(rng));
+		return length(p) > 0.0f ? normalize(p) : vec3(0, 1, 0);
+	};
+	auto box = [&]() {
+		return bounds.min + size * vec3(unit(rng), unit(rng), unit(rng));
+	};
+
+	vector<Ray> rays;
+	rays.reserve(count);
+
+	for(size_t i = 0; i < count; ++i){
+		const vec3 origin = inside ? box() : centre + sphere() * radius * 3.0f;
+		const vec3 target = inside ? box() : centre + sphere() * radius * unit(rng);
+		const vec3 direction = target - origin;
+
+		rays.emplace_back(vec4(origin, 1), vec4(length(direction) > 0.0f ? normalize(direction) : sphere(), 0));
+	}
+
+	return rays;
+}
+
+// ------------------------------------------------------------
+// Report
+
+static void print(const MicroResult &result)
+{
+	cout << left << setw(36) << result.kernel << setw(10) << result.order << right
+	     << setw(10) << result.tests << fixed << setprecision(1) << setw(12) << result.ns
+	     << setprecision(2) << setw(12) << 1e3 / result.ns
+	     << setprecision(1) << setw(10) << result.hitRate * 100.0 << "%" << endl;
+}
+
+class MicroSuite {
+public:
+	MicroSuite(const MicroOptions &options) : m_options(options), m_rng(options.seed) {}
+
+	bool wants(const string &kernel) const
+	{
+		return m_options.filter.empty() || kernel.find(m_options.filter) != string::npos;
+	}
+
+	// Run test over a ray batch in every order
+	template<typename Test>
+	void rays(const string &kernel, const vector<Ray> &coherent, const vector<Ray> &random, Test test)
+	{
+		if(!wants(kernel))
+			return;
+
+		run(kernel, "coherent", coherent, test);
+		run(kernel, "sorted", sortedByOutcome(coherent, test), test);
+		run(kernel, "shuffled", shuffled(coherent, m_rng), test);
+		run(kernel, "random", random, test);
+	}
+
+	// Run test over a batch in random order and sorted by outcome
+	template<typename T, typename Test>
+	void items(const string &kernel, const vector<T> &random, Test test)
+	{
+		if(!wants(kernel))
+			return;
+
+		run(kernel, "random", random, test);
+		run(kernel, "sorted", sortedByOutcome(random, test), test);
+	}
+
+	mt19937 &rng() { return m_rng; }
+	const vector<MicroResult> &results() const { return m_results; }
+
+private:
+	template<typename T, typename Test>
+	void run(const string &kernel, const string &order, const vector<T> &batch, Test test)
+	{
+		MicroResult result = measure(m_options, batch, test);
+		result.kernel = kernel;
+		result.order = order;
+
+		print(result);
+		m_results.push_back(result);
+	}
+
+	const MicroOptions &m_options;
+	mt19937 m_rng;
+	vector<MicroResult> m_results;
+};
+
+// ------------------------------------------------------------
+// Kernels
+
+static void primitives(MicroSuite &suite, uint side)
+{
+	const NonhierSphere sphere(vec3(0), 1.0);
+	const NonhierBox box(vec3(-0.5f), 1.0);
+
+	const AABB sphereBounds = sphere.bounds();
+	suite.rays("NonhierSphere::intersect", framingRays(side, sphereBounds),
+	           randomRays(side * side, sphereBounds, false, suite.rng()), [&](const Ray &r) {
+		double t = INF_DOUBLE;
+		uint32_t id;
+		return sphere.intersect(r, EPSILON, t, id);
+	});
+
+	const AABB boxBounds = box.bounds();
+	suite.rays("NonhierBox::intersect", framingRays(side, boxBounds),
+	           randomRays(side * side, boxBounds, false, suite.rng()), [&](const Ray &r) {
+		double t = INF_DOUBLE;
+		uint32_t id;
+		return box.intersect(r, EPSILON, t, id);
+	});
+
+	// A full block of random triangles in the unit cube
+	TriangleBlock block;
+	uniform_real_distribution<float> unit(-0.5f, 0.5f);
+	auto point = [&]() { return vec3(unit(suite.rng()), unit(suite.rng()), unit(suite.rng())); };
+	for(uint lane = 0; lane < SIMD_WIDTH; ++lane)
+		block.set(lane, point(), point(), point());
+
+	const AABB blockBounds(vec3(-0.5f), vec3(0.5f));
+	suite.rays("TriangleBlock::intersect (" + to_string(SIMD_WIDTH) + " tris)", framingRays(side, blockBounds),
+	           randomRays(side * side, blockBounds, false, suite.rng()), [&](const Ray &r) {
+		vfloat t;
+		return block.intersect(vec3(r.origin), vec3(r.direction), float(EPSILON), INF_FLOAT, t).bits() != 0;
+	});
+}
+
+static void mesh(MicroSuite &suite, uint side)
+{
+	if(!suite.wants("Mesh::intersect"))
+		return;
+
+	RenderSettings settings;
+	settings.multithreading = false;
+
+	// Loading prints its timing, which doesn't belong in the table
+	streambuf *cout_buffer = cout.rdbuf(nullptr);
+	Mesh cow("cow.obj", settings);
+	cout.rdbuf(cout_buffer);
+
+	const AABB bounds = cow.bounds();
+	const vector<Ray> coherent = framingRays(side, bounds);
+	const vector<Ray> random = randomRays(side * side, bounds, false, suite.rng());
+
+	auto test = [&](const Ray &r) {
+		double t = INF_DOUBLE;
+		uint32_t id;
+		return cow.intersect(r, EPSILON, t, id);
+	};
+
+	settings.wideBVH = true;
+	cow.prepare(settings);
+	suite.rays("Mesh::intersect cow (wide BVH)", coherent, random, test);
+
+	settings.wideBVH = false;
+	cow.prepare(settings);
+	suite.rays("Mesh::intersect cow (BVH)", coherent, random, test);
+}
+
+static void scene(MicroSuite &suite, uint side)
+{
+	if(!suite.wants("hier"))
+		return;
+
+	RenderSettings settings;
+	settings.multithreading = false;
+
+	LuaScene lua;
+	streambuf *cout_buffer = cout.rdbuf(nullptr);
+	const bool loaded = load_lua_scene("hier.lua", lua, settings);
+	cout.rdbuf(cout_buffer);
+
+	if(!loaded){
+		cerr << "Could not load hier.lua" << endl;
+		return;
+	}
+
+	// Primitives are prepared by compiling, before anything is traced
+	const CompiledScene compiled(lua.root, settings);
+	const SceneBVH bvh(lua.root, settings);
+
+	AABB bounds;
+	for(const Instance &instance : compiled.instances())
+		bounds.expand(instance.bounds);
+
+	const vector<Ray> coherent = cameraRays(side, lua.eye, lua.eye + lua.view, lua.up, lua.fov);
+	const vector<Ray> random = randomRays(side * side, bounds, true, suite.rng());
+
+	suite.rays("SceneNode::hit hier", coherent, random, [&](const Ray &r) {
+		return bool(lua.root->hit(r, EPSILON, INF_DOUBLE));
+	});
+	suite.rays("CompiledScene::intersect hier", coherent, random, [&](const Ray &r) {
+		return bool(compiled.intersect(r, EPSILON, INF_DOUBLE));
+	});
+	suite.rays("SceneBVH::intersect hier", coherent, random, [&](const Ray &r) {
+		return bool(bvh.intersect(r, EPSILON, INF_DOUBLE));
+	});
+}
+
+// Coefficients in [-range, range], a hit is any real root
+static void polyroots(MicroSuite &suite, uint side)
+{
+	struct Coefficients { double c[4]; };
+
+	auto batch = [&](double range) {
+		uniform_real_distribution<double> coefficient(-range, range);
+		vector<Coefficients> result(side * side);
+		for(auto &item : result)
+			for(double &c : item.c)
+				c = coefficient(suite.rng());
+		return result;
+	};
+
+	suite.items("quadraticRoots", batch(1.0), [](const Coefficients &k) {
+		double roots[2];
+		return quadraticRoots(k.c[0], k.c[1], k.c[2], roots) > 0;
+	});
+
+	// Monic, one or three real roots, hits are the three root cases
+	suite.items("cubicRoots", batch(3.0), [](const Coefficients &k) {
+		double roots[3];
+		return cubicRoots(k.c[0], k.c[1], k.c[2], roots) > 1;
+	});
+
+	suite.items("quarticRoots", batch(3.0), [](const Coefficients &k) {
+		double roots[4];
+		return quarticRoots(k.c[0], k.c[1], k.c[2], k.c[3], roots) > 0;
+	});
+}
+
+// ------------------------------------------------------------
+
+static void printUsage(const char *program)
+{
+	cerr << "Usage: " << program << " [options]\n"
+	     << "\n"
+	     << "  --assets=<dir>     cow.obj and hier.lua (default Assets)\n"
+	     << "  --filter=<text>    only kernels whose name contains text\n"
+	     << "  --side=<n>         batches of n x n rays (default 256)\n"
+	     << "  --repeats=<n>      timed rounds, the fastest counts (default 5)\n"
+	     << "  --min-ms=<ms>      shortest round (default 50)\n"
+	     << "  --seed=<n>         random batches (default 488)\n"
+	     << "  --csv=<file>       also write the results as CSV\n";
+}
+
+static bool parseOptions(int argc, char **argv, MicroOptions &options)
+{
+	for(int i = 1; i < argc; ++i){
+		const string arg(argv[i]);
+		const size_t equals = arg.find('=');
+		if(arg.compare(0, 2, "--") != 0 || equals == string::npos)
+			return false;
+
+		const string name = arg.substr(2, equals - 2);
+		const string value = arg.substr(equals + 1);
+
+		if(name == "assets")
+			options.assets = value;
+		else if(name == "filter")
+			options.filter = value;
+		else if(name == "csv")
+			options.csv = value;
+		else if(name == "side")
+			options.side = uint(std::max(1, atoi(value.c_str())));
+		else if(name == "repeats")
+			options.repeats = uint(std::max(1, atoi(value.c_str())));
+		else if(name == "min-ms")
+			options.minMs = atof(value.c_str());
+		else if(name == "seed")
+			options.seed = uint(atoi(value.c_str()));
+		else
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	MicroOptions options;
+	if(!parseOptions(argc, argv, options)){
+		printUsage(argv[0]);
+		return 2;
+	}
+
+	// Written before moving into the assets directory
+	ofstream csv;
+	if(!options.csv.empty())
+		csv.open(options.csv);
+
+	if(chdir(options.assets.c_str()) != 0){
+		cerr << "Could not open " << options.assets << endl;
+		return 2;
+	}
+
+	cout << left << setw(36) << "kernel" << setw(10) << "order" << right << setw(10) << "tests"
+	     << setw(12) << "ns/test" << setw(12) << "Mtests/s" << setw(11) << "hit rate" << endl;
+
+	MicroSuite suite(options);
+	primitives(suite, options.side);
+	mesh(suite, options.side);
+	scene(suite, options.side);
+	polyroots(suite, options.side);
+
+	if(csv.is_open()){
+		csv << "kernel,order,tests,ns_per_test,hit_rate" << endl;
+		for(const MicroResult &result : suite.results())
+			csv << "\"" << result.kernel << "\"," << result.order << "," << result.tests << ","
+			    << result.ns << "," << result.hitRate << endl;
+	}
+
+	return 0;
+}
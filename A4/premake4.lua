@@ -46,11 +46,30 @@ if os.target() == "macosx" then
     linkOptionList = { "-framework IOKit", "-framework Cocoa", "-framework CoreVideo", "-framework OpenGL" }
 end
 
-buildOptions = {"-std=c++11 -O2"}
+newoption {
+    trigger = "avx2",
+    description = "Build the ray packet kernels (Simd.hpp) with AVX2 instead of SSE2"
+}
+
+buildOptions = {"-std=c++17 -O2"}
+
+if _OPTIONS["avx2"] then
+    table.insert(buildOptions, "-mavx2 -mfma")
+end
 
 workspace "CS488-Projects"
     configurations { "Debug", "Release" }
 
+    filter "configurations:Debug"
+        defines { "DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        optimize "On"
+
+    filter {}
+
     project "A4"
         kind "ConsoleApp"
         language "C++"
@@ -64,10 +83,32 @@ workspace "CS488-Projects"
         includedirs (includeDirList)
         files { "*.cpp" }
 
-    filter "configurations:Debug"
-        defines { "DEBUG" }
-        symbols "On"
+    -- Headless benchmark (bench/Benchmark.cpp), the renderer without Main.cpp
+    project "A4-bench"
+        kind "ConsoleApp"
+        language "C++"
+        location "build"
+        objdir "build/bench"
+        targetdir "."
+        buildoptions (buildOptions)
+        libdirs (libDirectories)
+        links (linkLibs)
+        linkoptions (linkOptionList)
+        includedirs (includeDirList)
+        files { "*.cpp", "bench/Benchmark.cpp" }
+        removefiles { "Main.cpp" }
 
-    filter "configurations:Release"
-        defines { "NDEBUG" }
-        optimize "On"
+    -- Microbenchmarks of single kernels (bench/Microbench.cpp)
+    project "A4-microbench"
+        kind "ConsoleApp"
+        language "C++"
+        location "build"
+        objdir "build/microbench"
+        targetdir "."
+        buildoptions (buildOptions)
+        libdirs (libDirectories)
+        links (linkLibs)
+        linkoptions (linkOptionList)
+        includedirs (includeDirList)
+        files { "*.cpp", "bench/Microbench.cpp" }
+        removefiles { "Main.cpp" }
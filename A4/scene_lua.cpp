@@ -45,6 +45,7 @@
 #include <cstdio>
 #include <vector>
 #include <map>
+#include <chrono>
 
 #include "lua488.hpp"
 
@@ -56,10 +57,22 @@
 #include "Material.hpp"
 #include "PhongMaterial.hpp"
 #include "A4.hpp"
+#include "ThreadPool.hpp"
 
 typedef std::map<std::string,Mesh*> MeshMap;
 static MeshMap mesh_map;
 
+// Meshes loaded since the last gr.render, and when the first of them
+// started loading, to report that render's preprocessing time
+static std::vector<Mesh*> pending_meshes;
+static std::chrono::steady_clock::time_point mesh_load_start;
+
+// Settings from the command line, gr.render's settings table overrides them
+static RenderSettings render_settings;
+
+// Set by load_lua_scene, gr.render fills it in instead of rendering
+static LuaScene* captured_scene = nullptr;
+
 // Uncomment the following line to enable debugging messages
 // #define GRLUA_ENABLE_DEBUG
 
@@ -107,7 +120,7 @@ template<typename T>
 void get_tuple(lua_State* L, int arg, T* data, int n)
 {
   luaL_checktype(L, arg, LUA_TTABLE);
-  luaL_argcheck(L, lua_rawlen(L, arg) == n, arg, "N-tuple expected");
+  luaL_argcheck(L, lua_rawlen(L, arg) == (size_t)n, arg, "N-tuple expected");
   for (int i = 1; i <= n; i++) {
     lua_rawgeti(L, arg, i);
     data[i - 1] = luaL_checknumber(L, -1);
@@ -264,8 +277,13 @@ int gr_mesh_cmd(lua_State* L)
 	Mesh *mesh = nullptr;
 
 	if( i == mesh_map.end() ) {
-		mesh = new Mesh(obj_fname);
+		if (pending_meshes.empty())
+			mesh_load_start = std::chrono::steady_clock::now();
+
+		// Loads in the background, gr.render waits for it
+		mesh = new Mesh(obj_fname, render_settings);
 		mesh_map[sfname] = mesh;
+		pending_meshes.push_back(mesh);
 	} else {
 		mesh = i->second;
 	}
@@ -346,9 +364,97 @@ int gr_render_cmd(lua_State* L)
     lua_pop(L, 1);
   }
 
+  // Optional table of render settings, e.g. {supersampling = 3}
+  RenderSettings settings(render_settings);
+  if (!lua_isnoneornil(L, 11)) {
+    luaL_checktype(L, 11, LUA_TTABLE);
+
+    lua_pushnil(L);
+    while (lua_next(L, 11) != 0) {
+      // Copy the key and value so luaL_tolstring doesn't confuse lua_next
+      lua_pushvalue(L, -2);
+      const char* name = luaL_checkstring(L, -1);
+      const char* value = luaL_tolstring(L, -2, 0);
+
+      if (!settings.set(name, value)) {
+        return luaL_error(L, "Invalid render setting %s = %s", name, value);
+      }
+
+      lua_pop(L, 3);
+    }
+  }
+
+	// Finish loading the meshes issued since the last render, the others
+	// are already resident
+	std::vector<Mesh*> pending;
+	pending.swap(pending_meshes);
+
+	if (!pending.empty()) {
+		using Clock = std::chrono::steady_clock;
+		const auto waitStart = Clock::now();
+
+		for (Mesh *mesh : pending)
+			mesh->wait();
+
+		const auto end = Clock::now();
+		std::cout << "Mesh preprocessing: " << pending.size() << " meshes in "
+		          << std::chrono::duration<double, std::milli>(end - mesh_load_start).count() << "ms ("
+		          << std::chrono::duration<double, std::milli>(end - waitStart).count() << "ms waiting in gr.render)"
+		          << std::endl << std::endl;
+	}
+
+	if (captured_scene) {
+		if (!captured_scene->root) {
+			captured_scene->root = root->node;
+			captured_scene->filename = filename;
+			captured_scene->width = width;
+			captured_scene->height = height;
+			captured_scene->eye = eye;
+			captured_scene->view = view;
+			captured_scene->up = up;
+			captured_scene->fov = fov;
+			captured_scene->ambient = ambient;
+			captured_scene->lights = lights;
+		}
+		return 0;
+	}
+
+	// Time to first tile counts from this render's first mesh load, if it
+	// had one
+	const auto scene_start = pending.empty() ? std::chrono::steady_clock::now() : mesh_load_start;
+
 	Image im( width, height);
-	A4_Render(root->node, im, eye, view, up, fov, ambient, lights);
-    im.savePng( filename );
+	Image costs( settings.heatmap != HeatmapOff ? width : 0, settings.heatmap != HeatmapOff ? height : 0);
+	A4_Render(root->node, im, eye, view, up, fov, ambient, lights, settings, scene_start,
+	          settings.heatmap != HeatmapOff ? &costs : nullptr);
+	// The output setting overrides the scene's file name
+	const std::string output = settings.output.empty() ? std::string(filename) : settings.output;
+
+	// False colour cost next to the image, foo.png -> foo-heatmap.png,
+	// encoded on the pool while this thread encodes the image
+	std::string heatmap_name;
+	float white_point = 0.0f;
+	ThreadPool::Task heatmap_saved;
+	if (settings.heatmap != HeatmapOff) {
+		heatmap_name = output;
+		const size_t extension = heatmap_name.rfind(".png");
+		if (extension != std::string::npos && extension + 4 == heatmap_name.size())
+			heatmap_name.erase(extension);
+		heatmap_name += "-heatmap.png";
+
+		heatmap_saved = ThreadPool::shared().submit([&]() {
+			costs.heatmap(&white_point).savePng(heatmap_name);
+		});
+	}
+
+    im.savePng( output );
+
+	if (heatmap_saved.valid()) {
+		heatmap_saved.wait();
+		std::cout << "Saved " << heatmap_name << " (white at "
+		          << white_point << (settings.heatmap == HeatmapTime ? "us" : " box/triangle tests")
+		          << " per pixel)" << std::endl;
+	}
 
 	return 0;
 }
@@ -556,8 +662,10 @@ static const luaL_Reg grlib_node_methods[] = {
 
 // This function calls the lua interpreter to define the scene and
 // raytrace it as appropriate.
-bool run_lua(const std::string& filename)
+bool run_lua(const std::string& filename, const RenderSettings& settings)
 {
+  render_settings = settings;
+
   GRLUA_DEBUG("Importing scene from " << filename);
   
   // Start a lua interpreter
@@ -596,3 +704,15 @@ bool run_lua(const std::string& filename)
 
   return true;
 }
+
+bool load_lua_scene(const std::string& filename, LuaScene& scene, const RenderSettings& settings)
+{
+  // Nodes outlive the interpreter (gr_node_gc_cmd doesn't free them), so
+  // the captured scene stays valid after run_lua returns
+  scene = LuaScene();
+  captured_scene = &scene;
+  const bool ok = run_lua(filename, settings);
+  captured_scene = nullptr;
+
+  return ok && scene.root;
+}
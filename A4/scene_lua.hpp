@@ -3,5 +3,32 @@
 #pragma once
 
 #include <string>
+#include <list>
 
-bool run_lua( const std::string& filename );
+#include <glm/glm.hpp>
+
+#include "RenderSettings.hpp"
+
+class SceneNode;
+class Light;
+
+bool run_lua( const std::string& filename,
+              const RenderSettings& settings = RenderSettings() );
+
+// What a scene script passes to gr.render
+struct LuaScene {
+  SceneNode* root = nullptr;
+  std::string filename;
+  int width = 0;
+  int height = 0;
+  glm::vec3 eye, view, up;
+  double fov = 0.0;
+  glm::vec3 ambient;
+  std::list<Light*> lights;
+};
+
+// Run a scene script like run_lua, but don't render: the first gr.render
+// call fills in scene (with every mesh loaded) and the others are skipped.
+// Returns false if the script failed or never called gr.render.
+bool load_lua_scene( const std::string& filename, LuaScene& scene,
+                     const RenderSettings& settings = RenderSettings() );